@@ -0,0 +1,212 @@
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch.h"
+#include "encoder.h"
+#include "job.h"
+#include "spscqueue.h"
+#include "wavfactory.h"
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::pcm16;
+
+namespace {
+	// Files each stage may hold per worker before the stage behind it has to wait
+	const size_t QUEUE_DEPTH = 2;
+
+	struct BatchItem {
+		string input;
+		string output;
+		EncodeJob job;
+		int type;
+
+		vector<char> data; //Input file, then encoded output
+		string error;
+	};
+
+	struct BatchWorker {
+		SpscQueue<BatchItem*> in;
+		SpscQueue<BatchItem*> out;
+		encoder::Workspace workspace;
+
+		BatchWorker() : in(QUEUE_DEPTH), out(QUEUE_DEPTH) {}
+	};
+
+	// Parses the list file; reports bad lines and leaves them out
+	bool read_list(const char* listFile, vector<BatchItem*>& items) {
+		FILE* file = fopen(listFile, "r");
+		if (file == NULL) {
+			cerr << "Could not open file: " << listFile << endl;
+			return false;
+		}
+
+		bool ok = true;
+		string line;
+		int lineNumber = 0;
+		int c;
+		do {
+			c = fgetc(file);
+			if (c != '\n' && c != EOF) {
+				if (c != '\r') line += (char)c;
+				continue;
+			}
+			lineNumber++;
+			if (line.empty()) continue;
+
+			vector<string> fields = split_tabs(line);
+			line.clear();
+			if (fields.size() < 2) {
+				cerr << listFile << ":" << lineNumber << ": expected an input and an output" << endl;
+				ok = false;
+				continue;
+			}
+
+			std::unique_ptr<BatchItem> item(new BatchItem);
+			item->input = fields[fields.size() - 2];
+			item->output = fields[fields.size() - 1];
+			bool valid = true;
+			for (size_t i = 0; i + 2 < fields.size(); i++) {
+				if (!item->job.parse_option(fields[i].c_str())) {
+					cerr << listFile << ":" << lineNumber << ": unknown option: " << fields[i] << endl;
+					valid = false;
+				}
+			}
+			item->job.inputFile = item->input.c_str();
+			item->job.outputFile = item->output.c_str();
+			item->type = item->job.output_type();
+			if (item->type < 0) {
+				cerr << listFile << ":" << lineNumber << ": unsupported output format: " << item->output << endl;
+				valid = false;
+			}
+
+			if (valid)
+				items.push_back(item.release());
+			else
+				ok = false;
+		} while (c != EOF);
+
+		fclose(file);
+		return ok;
+	}
+
+	// Stage 1: sequential reads, so a spinning disk isn't asked to seek between files
+	void read_stage(const vector<BatchItem*>* items, vector<BatchWorker*>* workers) {
+		for (size_t i = 0; i < items->size(); i++) {
+			BatchItem* item = (*items)[i];
+			FILE* file = fopen(item->input.c_str(), "rb");
+			if (file == NULL) {
+				item->error = "Could not open file: " + item->input;
+			} else {
+				size_t size = 0;
+				for (;;) {
+					if (item->data.size() < size + 0x10000)
+						item->data.resize((size + 0x10000) * 2);
+					size_t r = fread(item->data.data() + size, 1, item->data.size() - size, file);
+					if (r == 0) break;
+					size += r;
+				}
+				if (ferror(file))
+					item->error = "Could not read file: " + item->input;
+				fclose(file);
+				item->data.resize(size);
+			}
+			(*workers)[i % workers->size()]->in.push(item);
+		}
+		for (size_t w = 0; w < workers->size(); w++)
+			(*workers)[w]->in.push(nullptr);
+	}
+
+	// Stage 2: decode the WAV, analyse and encode
+	void encode_stage(BatchWorker* worker, CoefCache* cache) {
+		BatchItem* item;
+		while ((item = worker->in.pop()) != nullptr) {
+			if (item->error.empty()) {
+				try {
+					std::unique_ptr<PCM16> wav(wavfactory::from_buffer(item->data.data(), item->data.size()));
+					item->job.apply_loop(wav.get());
+
+					encoder::EncodeOptions options;
+					options.coefCache = cache;
+					options.workspace = &worker->workspace;
+					item->job.apply_options(wav.get(), &options);
+					int size = encoder::get_size(wav.get(), item->type, &options);
+					item->data.resize(size);
+					encoder::encode_to_ptr(wav.get(), nullptr, item->type, item->data.data(), &options);
+				} catch (std::exception& e) {
+					item->error = e.what();
+				}
+			}
+			if (!item->error.empty())
+				vector<char>().swap(item->data);
+			worker->out.push(item);
+		}
+		worker->out.push(nullptr);
+	}
+}
+
+int batch::run(const char* listFile, int workerCount, const char* cacheDir) {
+	vector<BatchItem*> items;
+	bool ok = read_list(listFile, items);
+
+	if (workerCount <= 0)
+		workerCount = std::thread::hardware_concurrency();
+	if (workerCount <= 0)
+		workerCount = 1;
+
+	CoefCache* cache = cacheDir != NULL ? new CoefCache(cacheDir) : nullptr;
+
+	vector<BatchWorker*> workers;
+	for (int i = 0; i < workerCount; i++)
+		workers.push_back(new BatchWorker);
+
+	// Items are dealt to the workers round-robin and collected in the same order, so each
+	// queue has one producer and one consumer and outputs come back in list order
+	vector<std::thread> threads;
+	threads.push_back(std::thread(read_stage, &items, &workers));
+	for (int i = 0; i < workerCount; i++)
+		threads.push_back(std::thread(encode_stage, workers[i], cache));
+
+	// Stage 3: write outputs on this thread
+	int done = 0;
+	for (size_t i = 0; i < items.size(); i++) {
+		BatchItem* item = workers[i % workers.size()]->out.pop();
+		if (item->error.empty()) {
+			FILE* file = fopen(item->output.c_str(), "wb");
+			if (file == NULL) {
+				item->error = "Could not open file for writing: " + item->output;
+			} else {
+				bool written = fwrite(item->data.data(), 1, item->data.size(), file) == item->data.size();
+				written = (fclose(file) == 0) && written;
+				if (!written) item->error = "Could not write file: " + item->output;
+			}
+		}
+
+		done++;
+		if (item->error.empty()) {
+			cerr << "[" << done << "/" << items.size() << "] " << item->output << endl;
+		} else {
+			cerr << "[" << done << "/" << items.size() << "] " << item->input << ": " << item->error << endl;
+			ok = false;
+		}
+		delete item;
+	}
+
+	// Collect the end-of-input markers
+	for (size_t w = 0; w < workers.size(); w++)
+		workers[w]->out.pop();
+	for (size_t t = 0; t < threads.size(); t++)
+		threads[t].join();
+	for (size_t w = 0; w < workers.size(); w++)
+		delete workers[w];
+	delete cache;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+namespace rstmcpp {
+	namespace batch {
+		// Converts every job in a list file, one per line, fields separated by tabs:
+		//   <option>... <input> <output>
+		// with the same per-file loop options as a normal run. A reader thread loads inputs,
+		// the given number of workers (0 = one per core) decode and encode them, and the
+		// calling thread writes outputs in list order; the stages are connected by bounded
+		// queues so disk reads and writes overlap with encoding. Returns a process exit code.
+		int run(const char* listFile, int workers, const char* cacheDir);
+	}
+}
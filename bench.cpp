@@ -0,0 +1,333 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#if defined _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+#include "bench.h"
+#include "encoder.h"
+#include "hash.h"
+#include "wavfactory.h"
+
+using std::string;
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::pcm16;
+
+namespace {
+	struct BenchCase {
+		const char* name;
+		int channels;
+		int sampleRate;
+		int bits;
+		int frames;
+		int loopStart; //-1 for no loop; loops run to the end
+	};
+
+	// Smallest first, since peak memory is only ever reported for the process as a whole
+	const BenchCase CASES[] = {
+		{ "sfx-mono8", 1, 22050, 8, 22050 * 3 / 4, -1 },
+		{ "sfx-stereo16", 2, 32000, 16, 32000 * 3 / 2, -1 },
+		{ "sfx-loop-mono16", 1, 32000, 16, 32000 * 2, 0 },
+		{ "music-stereo8", 2, 32000, 8, 32000 * 180, -1 },
+		{ "music-loop-stereo16", 2, 44100, 16, 44100 * 180, 44100 * 12 + 1234 },
+		{ "ambience-loop-8ch16", 8, 32000, 16, 32000 * 600, 32000 * 60 },
+	};
+
+	struct Format {
+		const char* name;
+		int type;
+	};
+
+	const Format FORMATS[] = {
+		{ "brstm", encoder::FileType::RSTM },
+		{ "bcstm", encoder::FileType::CSTM },
+		{ "bcwav", encoder::FileType::CWAV },
+	};
+
+	struct BaselineEntry {
+		double samplesPerSecond;
+		uint64_t hash;
+	};
+
+	int triangle(uint32_t phase) {
+		uint32_t x = phase >> 16;
+		return (int)(x < 0x8000 ? x * 2 : (0xFFFF - x) * 2) - 0x8000;
+	}
+
+	uint32_t phase_step(int frequency, int sampleRate) {
+		return (uint32_t)(((uint64_t)frequency << 32) / sampleRate);
+	}
+
+	// Two detuned triangle waves under a slow envelope, plus noise. Integer arithmetic
+	// only, so the corpus (and therefore the hashes in bench-reference.json) is the same on
+	// every platform.
+	vector<int16_t> synthesize(const BenchCase& c) {
+		vector<int16_t> samples((size_t)c.frames * c.channels);
+		for (int ch = 0; ch < c.channels; ch++) {
+			uint32_t noise = 0x12345678u + 0x9E3779B9u * (ch + 1);
+			uint32_t p1 = 0, p2 = 0, p3 = 0x40000000u;
+			uint32_t s1 = phase_step(110 + 55 * ch, c.sampleRate);
+			uint32_t s2 = phase_step(331 + 20 * ch, c.sampleRate);
+			uint32_t s3 = phase_step(1, c.sampleRate) / 4;
+			int16_t* out = samples.data() + ch;
+			for (int i = 0; i < c.frames; i++) {
+				noise = noise * 1664525u + 1013904223u;
+				int s = (triangle(p1) * 3 + triangle(p2) * 2) / 6 + (int)((noise >> 20) & 0xFFF) - 0x800;
+				s = (int)(((int64_t)s * (triangle(p3) + 0x8000)) >> 16);
+				if (s > 32767) s = 32767;
+				if (s < -32768) s = -32768;
+				out[(size_t)i * c.channels] = (int16_t)s;
+				p1 += s1;
+				p2 += s2;
+				p3 += s3;
+			}
+		}
+		return samples;
+	}
+
+	void put16(vector<uint8_t>& out, uint32_t value) {
+		out.push_back((uint8_t)value);
+		out.push_back((uint8_t)(value >> 8));
+	}
+
+	void put32(vector<uint8_t>& out, uint32_t value) {
+		put16(out, value & 0xFFFF);
+		put16(out, value >> 16);
+	}
+
+	void put_id(vector<uint8_t>& out, const char* id) {
+		out.insert(out.end(), id, id + 4);
+	}
+
+	// A complete WAV file, with a smpl chunk if the case loops
+	vector<uint8_t> make_wav(const BenchCase& c) {
+		vector<int16_t> samples = synthesize(c);
+		uint32_t dataSize = (uint32_t)(samples.size() * (c.bits / 8));
+
+		vector<uint8_t> wav;
+		wav.reserve(dataSize + 128);
+		put_id(wav, "RIFF");
+		put32(wav, 0);
+		put_id(wav, "WAVE");
+
+		put_id(wav, "fmt ");
+		put32(wav, 16);
+		put16(wav, 1);
+		put16(wav, c.channels);
+		put32(wav, c.sampleRate);
+		put32(wav, c.sampleRate * c.channels * (c.bits / 8));
+		put16(wav, c.channels * (c.bits / 8));
+		put16(wav, c.bits);
+
+		if (c.loopStart >= 0) {
+			put_id(wav, "smpl");
+			put32(wav, 36 + 24);
+			for (int i = 0; i < 7; i++) put32(wav, 0);
+			put32(wav, 1); //sampleLoopCount
+			put32(wav, 0);
+			put32(wav, 0); //loopID
+			put32(wav, 0); //type
+			put32(wav, c.loopStart);
+			put32(wav, c.frames);
+			put32(wav, 0);
+			put32(wav, 0);
+		}
+
+		put_id(wav, "data");
+		put32(wav, dataSize);
+		for (size_t i = 0; i < samples.size(); i++) {
+			if (c.bits == 8)
+				wav.push_back((uint8_t)((samples[i] >> 8) + 0x80));
+			else
+				put16(wav, (uint16_t)samples[i]);
+		}
+
+		uint32_t riffSize = (uint32_t)wav.size() - 8;
+		wav[4] = (uint8_t)riffSize;
+		wav[5] = (uint8_t)(riffSize >> 8);
+		wav[6] = (uint8_t)(riffSize >> 16);
+		wav[7] = (uint8_t)(riffSize >> 24);
+		return wav;
+	}
+
+	long peak_rss_kb() {
+#if defined _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+		return (long)(counters.PeakWorkingSetSize / 1024);
+#else
+		struct rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined __APPLE__
+		return usage.ru_maxrss / 1024; //Bytes on macOS
+#else
+		return usage.ru_maxrss;
+#endif
+#endif
+	}
+
+	// Encodes one loaded source on several threads at once, cycling through the formats, and
+	// checks every output against the hash of the same format encoded alone
+	bool check_concurrent(const vector<uint8_t>& wav, int threads, const uint64_t* hashes) {
+		const size_t formatCount = sizeof(FORMATS) / sizeof(FORMATS[0]);
+		const PCM16* pcm = wavfactory::from_buffer(wav.data(), wav.size());
+		vector<uint64_t> results(threads);
+		vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.push_back(std::thread([pcm, t, &results]() {
+				int size;
+				char* output = encoder::encode(pcm, nullptr, &size, FORMATS[t % formatCount].type);
+				results[t] = hash::hash64(output, size);
+				free(output);
+			}));
+		}
+		for (int t = 0; t < threads; t++)
+			workers[t].join();
+		delete pcm;
+
+		for (int t = 0; t < threads; t++)
+			if (results[t] != hashes[t % formatCount]) return false;
+		return true;
+	}
+
+	// Finds "key": in a line of our own output and returns what follows it
+	const char* field(const string& line, const char* key) {
+		string quoted = string("\"") + key + "\": ";
+		size_t pos = line.find(quoted);
+		return pos == string::npos ? NULL : line.c_str() + pos + quoted.size();
+	}
+
+	string string_field(const string& line, const char* key) {
+		const char* value = field(line, key);
+		if (value == NULL || *value != '"') return string();
+		const char* end = strchr(value + 1, '"');
+		return end == NULL ? string() : string(value + 1, end);
+	}
+
+	// Reads the per-case lines written by an earlier run
+	bool read_baseline(const char* path, std::map<string, BaselineEntry>& entries) {
+		FILE* file = fopen(path, "r");
+		if (file == NULL) return false;
+
+		char buffer[1024];
+		while (fgets(buffer, sizeof(buffer), file) != NULL) {
+			string line(buffer);
+			string name = string_field(line, "name");
+			string format = string_field(line, "format");
+			const char* sps = field(line, "samplesPerSecond");
+			string hash = string_field(line, "hash");
+			if (name.empty() || format.empty() || sps == NULL || hash.empty()) continue;
+
+			BaselineEntry entry;
+			entry.samplesPerSecond = strtod(sps, NULL);
+			entry.hash = strtoull(hash.c_str(), NULL, 16);
+			entries[name + "/" + format] = entry;
+		}
+		fclose(file);
+		return true;
+	}
+}
+
+bench::BenchOptions::BenchOptions() : outputFile(NULL), baselineFile(NULL), threshold(10), repeat(1), only(NULL), concurrent(0) {}
+
+int bench::run(const BenchOptions& options) {
+	std::map<string, BaselineEntry> baseline;
+	if (options.baselineFile != NULL && !read_baseline(options.baselineFile, baseline)) {
+		fprintf(stderr, "Could not read baseline: %s\n", options.baselineFile);
+		return 1;
+	}
+
+	vector<string> lines;
+	int failures = 0;
+	for (size_t c = 0; c < sizeof(CASES) / sizeof(CASES[0]); c++) {
+		const BenchCase& bc = CASES[c];
+		if (options.only != NULL && strstr(bc.name, options.only) == NULL) continue;
+
+		vector<uint8_t> wav = make_wav(bc);
+		double samples = (double)bc.frames * bc.channels;
+		uint64_t hashes[sizeof(FORMATS) / sizeof(FORMATS[0])];
+
+		for (size_t f = 0; f < sizeof(FORMATS) / sizeof(FORMATS[0]); f++) {
+			const Format& format = FORMATS[f];
+
+			// Parsing the WAV is part of a real run, so it is timed too
+			double best = 0;
+			int size = 0;
+			uint64_t outputHash = 0;
+			for (int r = 0; r < (options.repeat > 0 ? options.repeat : 1); r++) {
+				std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+				PCM16* pcm = wavfactory::from_buffer(wav.data(), wav.size());
+				char* output = encoder::encode(pcm, nullptr, &size, format.type);
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+				outputHash = hash::hash64(output, size);
+				free(output);
+				delete pcm;
+				if (r == 0 || seconds < best) best = seconds;
+			}
+			double samplesPerSecond = samples / best;
+			hashes[f] = outputHash;
+
+			char line[512];
+			snprintf(line, sizeof(line),
+				"{\"name\": \"%s\", \"format\": \"%s\", \"channels\": %d, \"sampleRate\": %d, \"bits\": %d, \"looped\": %s, "
+				"\"frames\": %d, \"seconds\": %.6f, \"samplesPerSecond\": %.0f, \"peakRssKb\": %ld, \"outputSize\": %d, \"hash\": \"%016llx\"}",
+				bc.name, format.name, bc.channels, bc.sampleRate, bc.bits, bc.loopStart >= 0 ? "true" : "false",
+				bc.frames, best, samplesPerSecond, peak_rss_kb(), size, (unsigned long long)outputHash);
+			lines.push_back(line);
+
+			fprintf(stderr, "%-20s %s %8.3f s %12.0f samples/s", bc.name, format.name, best, samplesPerSecond);
+			std::map<string, BaselineEntry>::iterator it = baseline.find(string(bc.name) + "/" + format.name);
+			if (it != baseline.end()) {
+				double change = (samplesPerSecond / it->second.samplesPerSecond - 1) * 100;
+				fprintf(stderr, " %+6.1f%%", change);
+				if (it->second.hash != outputHash) {
+					fprintf(stderr, "  FAIL: output differs from baseline");
+					failures++;
+				} else if (change < -options.threshold) {
+					fprintf(stderr, "  FAIL: slower than baseline by more than %g%%", options.threshold);
+					failures++;
+				}
+			} else if (options.baselineFile != NULL) {
+				fprintf(stderr, "  (not in baseline)");
+			}
+			fprintf(stderr, "\n");
+		}
+
+		if (options.concurrent > 1) {
+			bool matched = check_concurrent(wav, options.concurrent, hashes);
+			fprintf(stderr, "%-20s %d concurrent encodes of one source: %s\n", bc.name, options.concurrent,
+				matched ? "outputs match" : "FAIL: outputs differ");
+			if (!matched) failures++;
+
+			char line[256];
+			snprintf(line, sizeof(line), "{\"name\": \"%s\", \"concurrentEncodes\": %d, \"matched\": %s}",
+				bc.name, options.concurrent, matched ? "true" : "false");
+			lines.push_back(line);
+		}
+	}
+
+	FILE* out = options.outputFile != NULL ? fopen(options.outputFile, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "Could not open file for writing: %s\n", options.outputFile);
+		return 1;
+	}
+	fprintf(out, "{\"version\": %d, \"cases\": [\n", encoder::ENCODER_VERSION);
+	for (size_t i = 0; i < lines.size(); i++)
+		fprintf(out, "%s%s\n", lines[i].c_str(), i + 1 < lines.size() ? "," : "");
+	fprintf(out, "], \"peakRssKb\": %ld}\n", peak_rss_kb());
+	if (out != stdout) fclose(out);
+
+	if (failures > 0)
+		fprintf(stderr, "%d of %d cases failed\n", failures, (int)lines.size());
+	return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+namespace rstmcpp {
+	namespace bench {
+		struct BenchOptions {
+			const char* outputFile; //JSON results; null for stdout
+			const char* baselineFile; //Results of an earlier run to compare against, or null
+			double threshold; //Allowed drop in samples/s against the baseline, in percent
+			int repeat; //Runs per case; the fastest counts
+			const char* only; //Only run cases whose name contains this, or null for all
+			int concurrent; //If more than 1, also encode each input on this many threads at once
+
+			BenchOptions();
+		};
+
+		// Generates a fixed corpus of synthetic WAV files in memory (short effects, a three
+		// minute stereo track, a ten minute 8-channel track; looped and not, 8- and 16-bit),
+		// converts each to every output format, and records wall time, samples per second,
+		// peak resident memory and a hash of each output as JSON, one case per line.
+		//
+		// With a baseline, a case fails if its output hash differs (the encoder's output
+		// changed) or it got slower by more than the threshold. With concurrent set, each case
+		// also fails if encoding one loaded input on that many threads at once gives any output
+		// that differs from encoding it alone. Returns a process exit code.
+		int run(const BenchOptions& options);
+	}
+}
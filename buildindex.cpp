@@ -0,0 +1,133 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+#if defined _WIN32
+#include <direct.h>
+#endif
+#include "buildindex.h"
+#include "encoder.h"
+#include "endian.h"
+#include "hash.h"
+#include "mappedfile.h"
+
+using std::string;
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::endian;
+
+// Everything besides the input bytes that goes into a key
+struct BuildKeyParams {
+	le_uint32_t encoderVersion;
+	le_uint32_t type;
+	le_uint32_t forceLoop;
+	le_uint32_t forceNoLoop;
+	le_int32_t loopStart;
+	le_int32_t loopEnd;
+	le_int32_t gainMillibels;
+	le_uint32_t normalize;
+	le_int32_t targetMillibels;
+	le_uint32_t channelMapLow;
+	le_uint32_t channelMapHigh;
+	le_int32_t analysisFrames;
+	le_uint32_t analysisByEnergy;
+	le_uint32_t autoLoop;
+	le_uint32_t loopAlignment;
+};
+
+static bool read_file(const char* path, vector<uint8_t>& out) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) return false;
+
+	out.clear();
+	uint8_t buffer[65536];
+	size_t r;
+	while ((r = fread(buffer, 1, sizeof(buffer), file)) > 0)
+		out.insert(out.end(), buffer, buffer + r);
+	bool ok = !ferror(file);
+	fclose(file);
+	return ok;
+}
+
+BuildIndex::BuildIndex(const char* directory) : directory(directory) {
+#if defined _WIN32
+	_mkdir(directory);
+#else
+	mkdir(directory, 0777);
+#endif
+
+	// Later lines override earlier ones, so record() only ever has to append
+	FILE* file = fopen((this->directory + "/index").c_str(), "r");
+	if (file == NULL) return;
+	unsigned long long key, outputHash;
+	char line[128];
+	while (fgets(line, sizeof(line), file) != NULL) {
+		if (sscanf(line, "%16llx %16llx", &key, &outputHash) == 2)
+			entries[key] = outputHash;
+	}
+	fclose(file);
+}
+
+bool BuildIndex::key(const EncodeJob& job, int type, uint64_t* keyOut) {
+	vector<uint8_t> input;
+	if (!read_file(job.inputFile, input)) return false;
+
+	BuildKeyParams params = {};
+	params.encoderVersion = encoder::ENCODER_VERSION;
+	params.type = type;
+	params.forceLoop = job.forceLoop;
+	params.forceNoLoop = job.forceNoLoop;
+	params.loopStart = job.loopStart;
+	params.loopEnd = job.loopEnd;
+	params.gainMillibels = (int32_t)floor(job.gainDb * 100 + 0.5);
+	params.normalize = job.normalize;
+	params.targetMillibels = (int32_t)floor(job.targetLoudness * 100 + 0.5);
+	if (!job.channelMap.empty()) {
+		uint64_t map = hash::hash64(job.channelMap.data(), job.channelMap.size());
+		params.channelMapLow = (uint32_t)map;
+		params.channelMapHigh = (uint32_t)(map >> 32);
+	}
+
+	params.analysisFrames = job.analysisFrames;
+	params.analysisByEnergy = job.analysisByEnergy;
+	params.autoLoop = job.autoLoop;
+	params.loopAlignment = job.loopAlignment;
+
+	uint64_t seed = hash::hash64(&params, sizeof(params));
+	*keyOut = hash::hash64(input.data(), input.size(), seed);
+	return true;
+}
+
+string BuildIndex::object_path(uint64_t outputHash) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.out", (unsigned long long)outputHash);
+	return directory + name;
+}
+
+bool BuildIndex::restore(uint64_t key, const char* outputFile) {
+	std::map<uint64_t, uint64_t>::iterator it = entries.find(key);
+	if (it == entries.end()) return false;
+	uint64_t outputHash = it->second;
+
+	vector<uint8_t> data;
+	if (read_file(outputFile, data) && hash::hash64(data.data(), data.size()) == outputHash)
+		return true;
+
+	// Output is missing or was modified; copy it back from the store if it's intact
+	if (!read_file(object_path(outputHash).c_str(), data)) return false;
+	if (hash::hash64(data.data(), data.size()) != outputHash) return false;
+	return write_file_atomically(outputFile, data.data(), data.size());
+}
+
+void BuildIndex::record(uint64_t key, const void* output, size_t length) {
+	uint64_t outputHash = hash::hash64(output, length);
+	if (!write_file_atomically(object_path(outputHash).c_str(), output, length)) return;
+
+	// One short line per append, so concurrent builds sharing an index don't interleave
+	FILE* file = fopen((directory + "/index").c_str(), "a");
+	if (file == NULL) return;
+	fprintf(file, "%016llx %016llx\n", (unsigned long long)key, (unsigned long long)outputHash);
+	fclose(file);
+	entries[key] = outputHash;
+}
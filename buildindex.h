@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include "job.h"
+
+namespace rstmcpp {
+	// Remembers which output each conversion produced, so a build can skip inputs that
+	// haven't changed. The directory holds a text file "index" mapping a key (input file
+	// contents, loop options, output format and encoder version) to the hash of the
+	// output, plus a copy of each output named after its hash.
+	class BuildIndex {
+	public:
+		BuildIndex(const char* directory);
+
+		// Hashes the input file together with everything else that affects the output.
+		// Returns false if the input can't be read.
+		static bool key(const EncodeJob& job, int type, uint64_t* keyOut);
+
+		// Makes outputFile hold the recorded result for key without encoding: returns true if
+		// it already does, or if it could be copied from the store. Returns false on a miss.
+		bool restore(uint64_t key, const char* outputFile);
+
+		// Records output as the result for key and stores a copy of it.
+		void record(uint64_t key, const void* output, size_t length);
+
+	private:
+		std::string object_path(uint64_t outputHash);
+
+		std::string directory;
+		std::map<uint64_t, uint64_t> entries;
+	};
+}
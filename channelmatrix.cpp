@@ -0,0 +1,71 @@
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include "channelmatrix.h"
+
+using namespace rstmcpp;
+
+ChannelMatrix::ChannelMatrix() : inputs(0), outputs(0) {}
+
+ChannelMatrix::ChannelMatrix(int inputs, int outputs) : inputs(inputs), outputs(outputs), weights(inputs * outputs, 0.0f) {}
+
+ChannelMatrix ChannelMatrix::stereo_downmix(int inputs) {
+	ChannelMatrix m(inputs, 2);
+	if (inputs == 1) {
+		m.weight(0, 0) = m.weight(1, 0) = 1;
+	} else if (inputs == 2) {
+		m.weight(0, 0) = m.weight(1, 1) = 1;
+	} else if (inputs == 6) {
+		//FL FR FC LFE BL BR
+		const float c = 0.7071f;
+		m.weight(0, 0) = 1;
+		m.weight(0, 2) = c;
+		m.weight(0, 4) = c;
+		m.weight(1, 1) = 1;
+		m.weight(1, 2) = c;
+		m.weight(1, 5) = c;
+	} else {
+		throw std::invalid_argument("No standard stereo downmix for " + std::to_string(inputs) + " channels");
+	}
+	return m;
+}
+
+ChannelMatrix ChannelMatrix::parse(const char* spec, int inputs) {
+	if (!strcmp(spec, "stereo"))
+		return stereo_downmix(inputs);
+
+	std::vector<std::vector<float> > rows;
+	const char* ptr = spec;
+	rows.push_back(std::vector<float>(inputs, 0.0f));
+	for (;;) {
+		// One term: <input>[*<weight>]
+		char* end;
+		long input = strtol(ptr, &end, 10);
+		if (end == ptr || input < 0)
+			throw std::invalid_argument(std::string("Bad channel map: ") + spec);
+		if (input >= inputs)
+			throw std::invalid_argument("Channel map uses channel " + std::to_string(input) + ", but the input only has " + std::to_string(inputs));
+		ptr = end;
+
+		double w = 1;
+		if (*ptr == '*') {
+			w = strtod(ptr + 1, &end);
+			if (end == ptr + 1)
+				throw std::invalid_argument(std::string("Bad channel map: ") + spec);
+			ptr = end;
+		}
+		rows.back()[input] += (float)w;
+
+		if (*ptr == '\0') break;
+		if (*ptr == ',') rows.push_back(std::vector<float>(inputs, 0.0f));
+		else if (*ptr != '+') throw std::invalid_argument(std::string("Bad channel map: ") + spec);
+		ptr++;
+	}
+
+	ChannelMatrix m(inputs, (int)rows.size());
+	for (size_t i = 0; i < rows.size(); i++)
+		for (int j = 0; j < inputs; j++)
+			m.weight((int)i, j) = rows[i][j];
+	return m;
+}
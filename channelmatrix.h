@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+
+namespace rstmcpp {
+	// Maps input channels to output channels: output channel i is the sum over j of
+	// weight(i, j) * input channel j. Covers reordering, picking a subset (to split a
+	// multichannel file) and downmixing.
+	struct ChannelMatrix {
+		int inputs;
+		int outputs;
+		std::vector<float> weights; //outputs rows of inputs weights each
+
+		ChannelMatrix();
+		ChannelMatrix(int inputs, int outputs);
+
+		float& weight(int output, int input) { return weights[output * inputs + input]; }
+		float weight(int output, int input) const { return weights[output * inputs + input]; }
+
+		// Parses a comma-separated list of output channels, each a +-separated list of
+		// input channel numbers (from 0), optionally scaled: "1,0" swaps a stereo pair,
+		// "2,3" takes the second pair, "0+2*0.707+4*0.707,1+2*0.707+5*0.707" is a 5.1 to
+		// stereo downmix. "stereo" is short for the standard downmix of 1, 2 or 6 channels.
+		// Throws std::invalid_argument on bad syntax or out-of-range channels.
+		static ChannelMatrix parse(const char* spec, int inputs);
+
+		// ITU-R BS.775 stereo downmix (LFE dropped) for 5.1 input; mono is duplicated and
+		// stereo passes through.
+		static ChannelMatrix stereo_downmix(int inputs);
+	};
+}
@@ -0,0 +1,111 @@
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+#if defined _WIN32
+#include <direct.h>
+#endif
+#include "coefcache.h"
+#include "endian.h"
+#include "hash.h"
+#include "mappedfile.h"
+
+using namespace rstmcpp;
+using namespace rstmcpp::endian;
+
+// Bump when dspadpcm::correlate_coefs output changes, so stale entries are never used.
+static const uint32_t CACHE_VERSION = 1;
+
+struct CoefCacheEntry {
+	char magic[4];
+	le_uint32_t version;
+	le_uint32_t keyLow;
+	le_uint32_t keyHigh;
+	le_int16_t coefs[16];
+};
+
+// Entries kept in memory before the map is cleared
+static const size_t MEMORY_ENTRIES = 4096;
+
+CoefCache::CoefCache(const char* directory) : hits(0), misses(0), onDisk(directory != NULL), directory(directory != NULL ? directory : "") {
+	if (!onDisk) return;
+
+	// Create the directory if it isn't there yet; failure will show up as cache misses
+#if defined _WIN32
+	_mkdir(directory);
+#else
+	mkdir(directory, 0777);
+#endif
+}
+
+uint64_t CoefCache::key(const int16_t* samples, int count) {
+	return hash::hash64(samples, count * sizeof(int16_t), CACHE_VERSION);
+}
+
+std::string CoefCache::path(uint64_t key) {
+	char name[32];
+	snprintf(name, sizeof(name), "/%016llx.coef", (unsigned long long)key);
+	return directory + name;
+}
+
+bool CoefCache::get(uint64_t key, int16_t* coefsOut) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::unordered_map<uint64_t, std::array<int16_t, 16> >::iterator it = memory.find(key);
+		if (it != memory.end()) {
+			memcpy(coefsOut, it->second.data(), 16 * sizeof(int16_t));
+			hits++;
+			return true;
+		}
+	}
+	if (!onDisk) {
+		misses++;
+		return false;
+	}
+
+	FILE* file = fopen(path(key).c_str(), "rb");
+	if (file == NULL) {
+		misses++;
+		return false;
+	}
+
+	CoefCacheEntry entry;
+	bool ok = fread(&entry, 1, sizeof(entry), file) == sizeof(entry)
+		&& memcmp(entry.magic, "RCOF", 4) == 0
+		&& entry.version == CACHE_VERSION
+		&& entry.keyLow == (uint32_t)key
+		&& entry.keyHigh == (uint32_t)(key >> 32);
+	fclose(file);
+
+	if (!ok) {
+		misses++;
+		return false;
+	}
+
+	for (int i = 0; i < 16; i++)
+		coefsOut[i] = entry.coefs[i];
+	remember(key, coefsOut);
+	hits++;
+	return true;
+}
+
+void CoefCache::remember(uint64_t key, const int16_t* coefs) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (memory.size() >= MEMORY_ENTRIES) memory.clear();
+	std::array<int16_t, 16>& entry = memory[key];
+	memcpy(entry.data(), coefs, 16 * sizeof(int16_t));
+}
+
+void CoefCache::put(uint64_t key, const int16_t* coefs) {
+	remember(key, coefs);
+	if (!onDisk) return;
+
+	CoefCacheEntry entry;
+	memcpy(entry.magic, "RCOF", 4);
+	entry.version = CACHE_VERSION;
+	entry.keyLow = (uint32_t)key;
+	entry.keyHigh = (uint32_t)(key >> 32);
+	for (int i = 0; i < 16; i++)
+		entry.coefs[i] = coefs[i];
+
+	write_file_atomically(path(key).c_str(), &entry, sizeof(entry));
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace rstmcpp {
+	// On-disk store of DSP-ADPCM coefficient sets, keyed by a hash of the channel
+	// samples they were computed from. One small file per entry; entries are
+	// published with an atomic rename, so several processes can share a directory.
+	// Entries are also kept in memory, so channels with identical samples within one
+	// process (the same channel written to several outputs, dual mono) are analysed once.
+	class CoefCache {
+	public:
+		// With a null directory, the cache only lives in memory.
+		CoefCache(const char* directory);
+
+		// Computes the cache key for one channel's (padded) sample buffer.
+		static uint64_t key(const int16_t* samples, int count);
+
+		// Copies the 16 cached coefficients for key into coefsOut. Returns false on a miss.
+		bool get(uint64_t key, int16_t* coefsOut);
+		void put(uint64_t key, const int16_t* coefs);
+
+		std::atomic<int> hits;
+		std::atomic<int> misses;
+
+	private:
+		std::string path(uint64_t key);
+		void remember(uint64_t key, const int16_t* coefs);
+
+		bool onDisk;
+		std::string directory;
+
+		std::mutex mutex;
+		std::unordered_map<uint64_t, std::array<int16_t, 16> > memory;
+	};
+}
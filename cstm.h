@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstring>
 #include <iostream>
 
@@ -337,4 +338,19 @@ namespace rstmcpp
         CSTMSEEKHeader* SEEKData() { return (CSTMSEEKHeader*)(Address() + _seekBlockRef._dataOffset); }
         CSTMDATAHeader* DATAData() { return (CSTMDATAHeader*)(Address() + _dataBlockRef._dataOffset); }
     };
+
+    // On-disk layouts
+    static_assert(sizeof(CSTMReference) == 0x08, "CSTMReference layout");
+    static_assert(sizeof(CSTMDataInfo) == 0x38, "CSTMDataInfo layout");
+    static_assert(offsetof(CSTMDataInfo, _loopStartSample) == 0x08, "CSTMDataInfo layout");
+    static_assert(offsetof(CSTMDataInfo, _lastBlockTotal) == 0x24, "CSTMDataInfo layout");
+    static_assert(offsetof(CSTMDataInfo, _sampleDataRef) == 0x30, "CSTMDataInfo layout");
+    static_assert(sizeof(CSTMADPCMInfo) == 0x30, "CSTMADPCMInfo layout");
+    static_assert(offsetof(CSTMADPCMInfo, _ps) == 0x22, "CSTMADPCMInfo layout");
+    static_assert(offsetof(CSTMINFOHeader, _dataInfo) == 0x20, "CSTMINFOHeader layout");
+    static_assert(sizeof(CSTMSEEKHeader) == 0x10, "CSTMSEEKHeader layout");
+    static_assert(sizeof(CSTMDATAHeader) == 0x10, "CSTMDATAHeader layout");
+    static_assert(sizeof(CSTMHeader) == 0x38, "CSTMHeader layout");
+    static_assert(offsetof(CSTMHeader, _infoBlockRef) == 0x14, "CSTMHeader layout");
+    static_assert(offsetof(CSTMHeader, _dataBlockRef) == 0x2C, "CSTMHeader layout");
 }
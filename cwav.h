@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstring>
 #include <iostream>
 
@@ -218,4 +219,17 @@ namespace rstmcpp
         CWAVINFOHeader* INFOData() { return (CWAVINFOHeader*)(Address() + _infoBlockRef._dataOffset); }
         CWAVDataHeader* DATAData() { return (CWAVDataHeader*)(Address() + _dataBlockRef._dataOffset); }
     };
+
+    // On-disk layouts
+    static_assert(sizeof(CWAVReference) == 0x08, "CWAVReference layout");
+    static_assert(sizeof(CWAVDataInfo) == 0x14, "CWAVDataInfo layout");
+    static_assert(sizeof(CWAVADPCMInfo) == 0x2C, "CWAVADPCMInfo layout");
+    static_assert(offsetof(CWAVADPCMInfo, _ps) == 0x20, "CWAVADPCMInfo layout");
+    static_assert(sizeof(CWAVChannelInfo) == 0x40, "CWAVChannelInfo layout");
+    static_assert(offsetof(CWAVChannelInfo, _adpcmInfo) == 0x14, "CWAVChannelInfo layout");
+    static_assert(offsetof(CWAVINFOHeader, _dataInfo) == 0x08, "CWAVINFOHeader layout");
+    static_assert(sizeof(CWAVDataHeader) == 0x0C, "CWAVDataHeader layout");
+    static_assert(sizeof(CWAVHeader) == 0x2C, "CWAVHeader layout");
+    static_assert(offsetof(CWAVHeader, _infoBlockRef) == 0x14, "CWAVHeader layout");
+    static_assert(offsetof(CWAVHeader, _dataBlockRef) == 0x20, "CWAVHeader layout");
 }
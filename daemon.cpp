@@ -0,0 +1,499 @@
+#include <iostream>
+#include "daemon.h"
+
+using std::cerr;
+using std::endl;
+
+#if defined _WIN32
+
+int rstmcpp::daemon::serve(const char* socketPath, int workers, const char* cacheDir) {
+	cerr << "Daemon mode needs Unix domain sockets and is not available on Windows" << endl;
+	return 1;
+}
+
+int rstmcpp::daemon::client(const char* socketPath, int argc, char** argv) {
+	cerr << "Daemon mode needs Unix domain sockets and is not available on Windows" << endl;
+	return 1;
+}
+
+#else
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "encoder.h"
+#include "job.h"
+#include "wavfactory.h"
+
+using std::string;
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::pcm16;
+
+namespace {
+	bool send_line(int fd, const string& line) {
+		string data = line + "\n";
+		const char* ptr = data.c_str();
+		size_t remaining = data.size();
+		while (remaining > 0) {
+			ssize_t r = write(fd, ptr, remaining);
+			if (r < 0 && errno == EINTR) continue;
+			if (r <= 0) return false;
+			ptr += r;
+			remaining -= r;
+		}
+		return true;
+	}
+
+	// Buffered reader for newline-terminated messages
+	class LineReader {
+	public:
+		LineReader(int fd) : fd(fd), timedOut(false) {}
+
+		// True if the last read_line failed because the socket's receive timeout ran out.
+		// Whatever was read of the line so far is kept for the next call.
+		bool timed_out() const { return timedOut; }
+
+		bool read_line(string& line) {
+			timedOut = false;
+			for (;;) {
+				size_t pos = buffer.find('\n');
+				if (pos != string::npos) {
+					line = buffer.substr(0, pos);
+					buffer.erase(0, pos + 1);
+					return true;
+				}
+				if (buffer.size() > 0x10000) return false;
+
+				char chunk[4096];
+				ssize_t r = read(fd, chunk, sizeof(chunk));
+				if (r < 0 && errno == EINTR) continue;
+				if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) timedOut = true;
+				if (r <= 0) return false;
+				buffer.append(chunk, r);
+			}
+		}
+
+	private:
+		int fd;
+		bool timedOut;
+		string buffer;
+	};
+
+	bool is_shm(const string& path) {
+		return path.compare(0, 4, "shm:") == 0;
+	}
+
+	// Thrown out of the encoder once the client has gone away
+	struct EncodeCancelled {};
+
+	// Sends encoder progress to the client as whole percentages. Once cancelled, whether by
+	// cancel() or because the client stopped reading, the next update stops the encode.
+	class SocketProgressTracker : public ProgressTracker {
+	public:
+		SocketProgressTracker(int fd) : fd(fd), lastPercent(-1) {}
+
+		void begin(float min, float max, float current) {
+			minValue = min;
+			maxValue = max;
+			currentValue = current;
+		}
+
+		void update(float value) {
+			if (cancelled) throw EncodeCancelled();
+			currentValue = value;
+			int percent = (int)(100 * (currentValue - minValue) / (maxValue - minValue));
+			if (percent > 100) percent = 100;
+			if (percent != lastPercent) {
+				lastPercent = percent;
+				if (!send_line(fd, "PROGRESS " + std::to_string(percent))) {
+					cancelled = true;
+					throw EncodeCancelled();
+				}
+			}
+		}
+
+		void finish() {}
+		void cancel() { cancelled = true; }
+
+	private:
+		int fd;
+		int lastPercent;
+	};
+
+	// State each worker thread keeps between requests
+	struct Worker {
+		encoder::Workspace workspace;
+		vector<char> input;
+		vector<char> output;
+	};
+
+	struct Server {
+		std::mutex mutex;
+		std::condition_variable ready;
+		std::deque<int> pending;
+		bool stopping;
+		string socketPath;
+		CoefCache* cache;
+
+		Server() : stopping(false), cache(nullptr) {}
+	};
+
+	PCM16* load_input(const string& path, Worker& worker) {
+		if (is_shm(path)) {
+			int fd = shm_open(path.c_str() + 4, O_RDONLY, 0);
+			if (fd < 0) throw std::runtime_error("Could not open shared memory object: " + path);
+			struct stat st;
+			if (fstat(fd, &st) != 0 || st.st_size == 0) {
+				close(fd);
+				throw std::runtime_error("Shared memory object is empty: " + path);
+			}
+			void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			close(fd);
+			if (data == MAP_FAILED) throw std::runtime_error("Could not map shared memory object: " + path);
+
+			try {
+				PCM16* wav = wavfactory::from_buffer(data, st.st_size);
+				munmap(data, st.st_size);
+				return wav;
+			} catch (...) {
+				munmap(data, st.st_size);
+				throw;
+			}
+		}
+
+		FILE* file = fopen(path.c_str(), "rb");
+		if (file == NULL) throw std::runtime_error("Could not open file: " + path);
+		size_t size = 0;
+		for (;;) {
+			if (worker.input.size() < size + 0x10000)
+				worker.input.resize((size + 0x10000) * 2);
+			size_t r = fread(worker.input.data() + size, 1, worker.input.size() - size, file);
+			if (r == 0) break;
+			size += r;
+		}
+		fclose(file);
+		return wavfactory::from_buffer(worker.input.data(), size);
+	}
+
+	void write_output(const string& path, PCM16* wav, int type, int size, ProgressTracker* progress, const encoder::EncodeOptions* options, Worker& worker) {
+		if (is_shm(path)) {
+			// Encode straight into the shared memory object
+			int fd = shm_open(path.c_str() + 4, O_CREAT | O_RDWR | O_TRUNC, 0600);
+			if (fd < 0) throw std::runtime_error("Could not create shared memory object: " + path);
+			if (ftruncate(fd, size) != 0) {
+				close(fd);
+				throw std::runtime_error("Could not resize shared memory object: " + path);
+			}
+			void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			close(fd);
+			if (data == MAP_FAILED) throw std::runtime_error("Could not map shared memory object: " + path);
+
+			try {
+				encoder::encode_to_ptr(wav, progress, type, data, options);
+				munmap(data, size);
+			} catch (...) {
+				munmap(data, size);
+				throw;
+			}
+			return;
+		}
+
+		if ((int)worker.output.size() < size)
+			worker.output.resize(size);
+		encoder::encode_to_ptr(wav, progress, type, worker.output.data(), options);
+
+		FILE* file = fopen(path.c_str(), "wb");
+		if (file == NULL) throw std::runtime_error("Could not open file for writing: " + path);
+		bool ok = fwrite(worker.output.data(), 1, size, file) == (size_t)size;
+		ok = (fclose(file) == 0) && ok;
+		if (!ok) throw std::runtime_error("Could not write file: " + path);
+	}
+
+	void handle_encode(int fd, const vector<string>& fields, Worker& worker, CoefCache* cache) {
+		if (fields.size() < 3) {
+			send_line(fd, "ERROR ENCODE needs an input and an output");
+			return;
+		}
+
+		EncodeJob job;
+		for (size_t i = 1; i < fields.size() - 2; i++) {
+			if (!job.parse_option(fields[i].c_str())) {
+				send_line(fd, "ERROR Unknown option: " + fields[i]);
+				return;
+			}
+		}
+		const string& input = fields[fields.size() - 2];
+		const string& output = fields[fields.size() - 1];
+		job.outputFile = output.c_str();
+
+		int type = job.output_type();
+		if (type < 0) {
+			send_line(fd, "ERROR Unsupported output format: " + output);
+			return;
+		}
+
+		try {
+			std::unique_ptr<PCM16> wav(load_input(input, worker));
+			job.apply_loop(wav.get());
+
+			encoder::EncodeOptions options;
+			options.coefCache = cache;
+			options.workspace = &worker.workspace;
+			job.apply_options(wav.get(), &options);
+
+			int size = encoder::get_size(wav.get(), type, &options);
+			SocketProgressTracker progress(fd);
+			write_output(output, wav.get(), type, size, &progress, &options, worker);
+
+			send_line(fd, "OK " + std::to_string(size));
+		} catch (EncodeCancelled&) {
+			//Nobody is left to tell
+		} catch (std::exception& e) {
+			send_line(fd, string("ERROR ") + e.what());
+		}
+	}
+
+	void request_stop(Server& server) {
+		{
+			std::lock_guard<std::mutex> lock(server.mutex);
+			server.stopping = true;
+		}
+		server.ready.notify_all();
+
+		// Wake up the accept() loop with a throwaway connection
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0) {
+			sockaddr_un addr;
+			memset(&addr, 0, sizeof(addr));
+			addr.sun_family = AF_UNIX;
+			strncpy(addr.sun_path, server.socketPath.c_str(), sizeof(addr.sun_path) - 1);
+			connect(fd, (sockaddr*)&addr, sizeof(addr));
+			close(fd);
+		}
+	}
+
+	// How long a worker waits for a request before checking whether it should give up the connection
+	const int IDLE_CHECK_SECONDS = 1;
+
+	void serve_connection(int fd, Worker& worker, Server& server) {
+		timeval timeout = { IDLE_CHECK_SECONDS, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		LineReader reader(fd);
+		string line;
+		for (;;) {
+			if (!reader.read_line(line)) {
+				if (!reader.timed_out()) return;
+
+				//An idle client keeps its worker only while nobody else needs it
+				std::lock_guard<std::mutex> lock(server.mutex);
+				if (server.stopping || !server.pending.empty()) return;
+				continue;
+			}
+
+			vector<string> fields = split_tabs(line);
+			if (fields[0] == "ENCODE") {
+				handle_encode(fd, fields, worker, server.cache);
+			} else if (fields[0] == "SHUTDOWN") {
+				send_line(fd, "OK 0");
+				request_stop(server);
+				return;
+			} else if (!fields[0].empty()) {
+				send_line(fd, "ERROR Unknown command: " + fields[0]);
+			}
+		}
+	}
+
+	void worker_loop(Server* server) {
+		Worker worker;
+		for (;;) {
+			int fd;
+			{
+				std::unique_lock<std::mutex> lock(server->mutex);
+				server->ready.wait(lock, [server]() { return server->stopping || !server->pending.empty(); });
+				if (server->pending.empty()) return;
+				fd = server->pending.front();
+				server->pending.pop_front();
+			}
+			serve_connection(fd, worker, *server);
+			close(fd);
+		}
+	}
+
+	string absolute_path(const char* path) {
+		if (path[0] == '/' || is_shm(path)) return path;
+		char cwd[4096];
+		if (getcwd(cwd, sizeof(cwd)) == NULL) return path;
+		return string(cwd) + "/" + path;
+	}
+}
+
+int rstmcpp::daemon::serve(const char* socketPath, int workers, const char* cacheDir) {
+	Server server;
+	server.socketPath = socketPath;
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+		cerr << "Socket path is too long: " << socketPath << endl;
+		return 1;
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	// A client that disconnects mid-request shouldn't take the server down
+	signal(SIGPIPE, SIG_IGN);
+
+	int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listenFd < 0) {
+		cerr << "Could not create socket: " << strerror(errno) << endl;
+		return 1;
+	}
+	//Only replace a socket left behind by an earlier server, never some other file
+	struct stat st;
+	if (lstat(socketPath, &st) == 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			cerr << socketPath << " already exists and is not a socket" << endl;
+			close(listenFd);
+			return 1;
+		}
+		unlink(socketPath);
+	}
+	if (bind(listenFd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, SOMAXCONN) != 0) {
+		cerr << "Could not listen on " << socketPath << ": " << strerror(errno) << endl;
+		close(listenFd);
+		return 1;
+	}
+
+	if (cacheDir != NULL)
+		server.cache = new CoefCache(cacheDir);
+
+	if (workers <= 0)
+		workers = std::thread::hardware_concurrency();
+	if (workers <= 0)
+		workers = 1;
+	vector<std::thread> threads;
+	for (int i = 0; i < workers; i++)
+		threads.push_back(std::thread(worker_loop, &server));
+
+	cerr << "Listening on " << socketPath << " with " << workers << " worker(s)" << endl;
+
+	for (;;) {
+		int fd = accept(listenFd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR) continue;
+			cerr << "accept failed: " << strerror(errno) << endl;
+			request_stop(server);
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(server.mutex);
+		if (server.stopping) {
+			close(fd);
+			break;
+		}
+		server.pending.push_back(fd);
+		server.ready.notify_one();
+	}
+
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+	close(listenFd);
+	unlink(socketPath);
+	delete server.cache;
+	return 0;
+}
+
+int rstmcpp::daemon::client(const char* socketPath, int argc, char** argv) {
+	string request;
+	if (argc == 1 && !strcmp(argv[0], "-shutdown")) {
+		request = "SHUTDOWN";
+	} else {
+		EncodeJob job;
+		request = "ENCODE";
+		for (int i = 0; i < argc; i++) {
+			if (job.parse_option(argv[i])) {
+				request += string("\t") + argv[i];
+			} else if (job.inputFile == NULL) {
+				job.inputFile = argv[i];
+			} else if (job.outputFile == NULL) {
+				job.outputFile = argv[i];
+			} else {
+				cerr << "Too many arguments: " << argv[i] << endl;
+				return 1;
+			}
+		}
+		if (job.inputFile == NULL || job.outputFile == NULL) {
+			cerr << "The client needs an input and an output file" << endl;
+			return 1;
+		}
+		// The server has its own working directory
+		request += "\t" + absolute_path(job.inputFile) + "\t" + absolute_path(job.outputFile);
+	}
+
+	sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socketPath, sizeof(addr.sun_path) - 1);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+		cerr << "Could not connect to " << socketPath << ": " << strerror(errno) << endl;
+		if (fd >= 0) close(fd);
+		return 1;
+	}
+
+	if (!send_line(fd, request)) {
+		cerr << "Could not send request" << endl;
+		close(fd);
+		return 1;
+	}
+
+	ProgressTracker progress;
+	bool started = false;
+	LineReader reader(fd);
+	string line;
+	int result = 1;
+	while (reader.read_line(line)) {
+		if (line.compare(0, 9, "PROGRESS ") == 0) {
+			if (!started) {
+				progress.begin(0, 100, 0);
+				started = true;
+			}
+			progress.update((float)atoi(line.c_str() + 9));
+		} else if (line.compare(0, 3, "OK ") == 0) {
+			if (started) progress.finish();
+			result = 0;
+			break;
+		} else if (line.compare(0, 6, "ERROR ") == 0) {
+			if (started) progress.cancel();
+			cerr << line.substr(6) << endl;
+			break;
+		}
+	}
+	if (result != 0 && line.compare(0, 6, "ERROR ") != 0)
+		cerr << "Connection closed by server" << endl;
+
+	close(fd);
+	return result;
+}
+
+#endif
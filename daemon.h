@@ -0,0 +1,23 @@
+#pragma once
+
+namespace rstmcpp {
+	namespace daemon {
+		// Listens on a Unix domain socket and encodes files on a pool of worker threads
+		// until a client sends SHUTDOWN. Returns a process exit code.
+		//
+		// Protocol: the client sends one request per line, fields separated by tabs:
+		//   ENCODE <option>... <input> <output>
+		//   SHUTDOWN
+		// where options are the per-file loop options (-l..., -noloop) and input/output are
+		// absolute paths, or shm:<name> for a POSIX shared memory object. The server answers
+		// with zero or more "PROGRESS <percent>" lines, then "OK <bytes>" or "ERROR <message>".
+		// A client that disconnects mid-request cancels its encode. A connection waiting for its
+		// next request is closed once other connections are queued for a worker or the server
+		// is shutting down.
+		int serve(const char* socketPath, int workers, const char* cacheDir);
+
+		// Sends one ENCODE request built from argv (the same options and file arguments as a
+		// normal run) and shows the server's progress. Returns a process exit code.
+		int client(const char* socketPath, int argc, char** argv);
+	}
+}
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+#include "decoder.h"
+#include "dspadpcm.h"
+#include "encoder.h"
+#include "inspector.h"
+#include "mappedfile.h"
+#include "wavwriter.h"
+
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::inspector;
+using namespace rstmcpp::pcm16;
+
+//Samples per channel decoded before they are handed to the writer
+static const uint32_t CHUNK_SAMPLES = 0x3800;
+
+void decoder::decode_to_wav(const uint8_t* data, size_t size, FILE* file) {
+	StreamInfo info = read_info(data, size);
+	if (info.encoding != 2)
+		throw std::runtime_error("Only DSP-ADPCM streams can be decoded");
+	if (info.channels <= 0 || info.numBlocks == 0 || info.samplesPerBlock == 0)
+		throw std::runtime_error("Stream has no blocks");
+	if (info.numBlocks > 1 && info.samplesPerBlock % 14 != 0)
+		throw std::runtime_error("Blocks don't hold whole frames");
+	if (info.numSamples > (uint64_t)(info.numBlocks - 1) * info.samplesPerBlock + info.lastBlockSamples)
+		throw std::runtime_error("Sample count is larger than the blocks");
+
+	int channels = info.channels;
+	vector<int> yn1(channels), yn2(channels);
+	for (int c = 0; c < channels; c++) {
+		yn1[c] = info.channelInfo[c].yn1;
+		yn2[c] = info.channelInfo[c].yn2;
+	}
+
+	WavWriter writer;
+	writer.open(file, channels, (int)info.sampleRate);
+	if (info.looped)
+		writer.set_loop(info.loopStart, info.numSamples);
+
+	vector<int16_t> interleaved((size_t)CHUNK_SAMPLES * channels);
+	for (uint32_t s = 0; s < info.numSamples; ) {
+		uint32_t block = s / info.samplesPerBlock;
+		uint32_t inBlock = s - block * info.samplesPerBlock;
+		uint32_t count = std::min(CHUNK_SAMPLES, std::min(info.samplesPerBlock - inBlock, info.numSamples - s));
+
+		for (int c = 0; c < channels; c++) {
+			size_t offset = block_offset(info, block, c) + inBlock / 14 * 8;
+			size_t length = (size_t)(count + 13) / 14 * 8;
+			if (offset > size || length > size - offset)
+				throw std::runtime_error("Header points outside the file");
+
+			const int16_t* coefs = info.channelInfo[c].coefs;
+			int16_t frame[14];
+			for (uint32_t i = 0; i < count; i += 14) {
+				int n = (int)std::min<uint32_t>(14, count - i);
+				dspadpcm::decode_frame(data + offset + i / 14 * 8, coefs, n, frame, &yn1[c], &yn2[c]);
+				for (int k = 0; k < n; k++)
+					interleaved[(size_t)(i + k) * channels + c] = frame[k];
+			}
+		}
+
+		writer.write(interleaved.data(), (int)count);
+		s += count;
+	}
+	writer.close();
+}
+
+int decoder::run(int argc, char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "-decode takes an input file and an output WAV file\n");
+		return 1;
+	}
+
+	MappedFile input;
+	if (!input.open(argv[0])) {
+		fprintf(stderr, "%s: could not open file\n", argv[0]);
+		return 1;
+	}
+	FILE* out = fopen(argv[1], "wb");
+	if (out == NULL) {
+		fprintf(stderr, "%s: could not open file for writing\n", argv[1]);
+		return 1;
+	}
+
+	try {
+		decode_to_wav(input.data(), input.size(), out);
+	} catch (std::exception& e) {
+		fclose(out);
+		fprintf(stderr, "%s: %s\n", argv[0], e.what());
+		return 1;
+	}
+	if (fclose(out) != 0) {
+		fprintf(stderr, "%s: could not write file\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
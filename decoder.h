@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+namespace rstmcpp {
+	namespace decoder {
+		// Decodes a DSP-ADPCM RSTM, CSTM, FSTM or CWAV file image to a 16-bit WAV, 0x3800
+		// samples per channel at a time through a pcm16::WavWriter, so memory use doesn't grow
+		// with the length of the stream (an RF64 file is written if it outgrows 4 GB). A
+		// looping stream gets a smpl chunk with its loop points. file must be seekable.
+		//
+		// Throws std::runtime_error if the image is malformed or can't be written.
+		void decode_to_wav(const uint8_t* data, size_t size, FILE* file);
+
+		// -decode <inputfile> <outputfile.wav>
+		// Returns a process exit code.
+		int run(int argc, char** argv);
+	}
+}
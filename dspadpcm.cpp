@@ -0,0 +1,488 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "dspadpcm.h"
+
+using namespace rstmcpp;
+
+//Coefficient analysis, ported from gc-dspadpcm-encode's DSPCorrelateCoefs. Every floating
+//point operation is kept in the original order, so the coefficients come out the same.
+namespace {
+	typedef double tvec[3];
+
+	void InnerProductMerge(tvec vecOut, const int16_t* pcmBuf) {
+		for (int i = 0; i <= 2; i++) {
+			vecOut[i] = 0.0f;
+			for (int x = 0; x < 14; x++)
+				vecOut[i] -= pcmBuf[x - i] * pcmBuf[x];
+		}
+	}
+
+	void OuterProductMerge(tvec mtxOut[3], const int16_t* pcmBuf) {
+		for (int x = 1; x <= 2; x++)
+			for (int y = 1; y <= 2; y++) {
+				mtxOut[x][y] = 0.0;
+				for (int z = 0; z < 14; z++)
+					mtxOut[x][y] += pcmBuf[z - x] * pcmBuf[z - y];
+			}
+	}
+
+	bool AnalyzeRanges(tvec mtx[3], int* vecIdxsOut) {
+		double recips[3];
+		double val, tmp, min, max;
+
+		for (int x = 1; x <= 2; x++) {
+			val = std::max(fabs(mtx[x][1]), fabs(mtx[x][2]));
+			if (val < DBL_EPSILON)
+				return true;
+
+			recips[x] = 1.0 / val;
+		}
+
+		int maxIndex = 0;
+		for (int i = 1; i <= 2; i++) {
+			for (int x = 1; x < i; x++) {
+				tmp = mtx[x][i];
+				for (int y = 1; y < x; y++)
+					tmp -= mtx[x][y] * mtx[y][i];
+				mtx[x][i] = tmp;
+			}
+
+			val = 0.0;
+			for (int x = i; x <= 2; x++) {
+				tmp = mtx[x][i];
+				for (int y = 1; y < i; y++)
+					tmp -= mtx[x][y] * mtx[y][i];
+
+				mtx[x][i] = tmp;
+				tmp = fabs(tmp) * recips[x];
+				if (tmp >= val) {
+					val = tmp;
+					maxIndex = x;
+				}
+			}
+
+			if (maxIndex != i) {
+				for (int y = 1; y <= 2; y++) {
+					tmp = mtx[maxIndex][y];
+					mtx[maxIndex][y] = mtx[i][y];
+					mtx[i][y] = tmp;
+				}
+				recips[maxIndex] = recips[i];
+			}
+
+			vecIdxsOut[i] = maxIndex;
+
+			if (mtx[i][i] == 0.0)
+				return true;
+
+			if (i != 2) {
+				tmp = 1.0 / mtx[i][i];
+				for (int x = i + 1; x <= 2; x++)
+					mtx[x][i] *= tmp;
+			}
+		}
+
+		min = 1.0e10;
+		max = 0.0;
+		for (int i = 1; i <= 2; i++) {
+			tmp = fabs(mtx[i][i]);
+			if (tmp < min)
+				min = tmp;
+			if (tmp > max)
+				max = tmp;
+		}
+
+		return min / max < 1.0e-10;
+	}
+
+	void BidirectionalFilter(tvec mtx[3], const int* vecIdxs, tvec vecOut) {
+		double tmp;
+
+		for (int i = 1, x = 0; i <= 2; i++) {
+			int index = vecIdxs[i];
+			tmp = vecOut[index];
+			vecOut[index] = vecOut[i];
+			if (x != 0)
+				for (int y = x; y <= i - 1; y++)
+					tmp -= vecOut[y] * mtx[i][y];
+			else if (tmp != 0.0)
+				x = i;
+			vecOut[i] = tmp;
+		}
+
+		for (int i = 2; i > 0; i--) {
+			tmp = vecOut[i];
+			for (int y = i + 1; y <= 2; y++)
+				tmp -= vecOut[y] * mtx[i][y];
+			vecOut[i] = tmp / mtx[i][i];
+		}
+
+		vecOut[0] = 1.0;
+	}
+
+	bool QuadraticMerge(tvec inOutVec) {
+		double v0, v1, v2 = inOutVec[2];
+		double tmp = 1.0 - (v2 * v2);
+
+		if (tmp == 0.0)
+			return true;
+
+		v0 = (inOutVec[0] - (v2 * v2)) / tmp;
+		v1 = (inOutVec[1] - (inOutVec[1] * v2)) / tmp;
+
+		inOutVec[0] = v0;
+		inOutVec[1] = v1;
+
+		return fabs(v1) > 1.0;
+	}
+
+	void FinishRecord(tvec in, tvec out) {
+		for (int z = 1; z <= 2; z++) {
+			if (in[z] >= 1.0)
+				in[z] = 0.9999999999;
+			else if (in[z] <= -1.0)
+				in[z] = -0.9999999999;
+		}
+		out[0] = 1.0;
+		out[1] = (in[2] * in[1]) + in[1];
+		out[2] = in[2];
+	}
+
+	void MatrixFilter(const tvec src, tvec dst) {
+		tvec mtx[3];
+
+		mtx[2][0] = 1.0;
+		for (int i = 1; i <= 2; i++)
+			mtx[2][i] = -src[i];
+
+		for (int i = 2; i > 0; i--) {
+			double val = 1.0 - (mtx[i][i] * mtx[i][i]);
+			for (int y = 1; y <= i; y++)
+				mtx[i - 1][y] = ((mtx[i][i] * mtx[i][y]) + mtx[i][y]) / val;
+		}
+
+		dst[0] = 1.0;
+		for (int i = 1; i <= 2; i++) {
+			dst[i] = 0.0;
+			for (int y = 1; y <= i; y++)
+				dst[i] += mtx[i][y] * dst[i - y];
+		}
+	}
+
+	void MergeFinishRecord(const tvec src, tvec dst) {
+		tvec tmp;
+		double val = src[0];
+
+		dst[0] = 1.0;
+		for (int i = 1; i <= 2; i++) {
+			double v2 = 0.0;
+			for (int y = 1; y < i; y++)
+				v2 += dst[y] * src[i - y];
+
+			if (val > 0.0)
+				dst[i] = -(v2 + src[i]) / val;
+			else
+				dst[i] = 0.0;
+
+			tmp[i] = dst[i];
+
+			for (int y = 1; y < i; y++)
+				dst[y] += dst[i] * dst[i - y];
+
+			val *= 1.0 - (dst[i] * dst[i]);
+		}
+
+		FinishRecord(tmp, dst);
+	}
+
+	double ContrastVectors(const tvec source1, const tvec source2) {
+		double val = (source2[2] * source2[1] + -source2[1]) / (1.0 - source2[2] * source2[2]);
+		double val1 = (source1[0] * source1[0]) + (source1[1] * source1[1]) + (source1[2] * source1[2]);
+		double val2 = (source1[0] * source1[1]) + (source1[1] * source1[2]);
+		double val3 = source1[0] * source1[2];
+		return val1 + (2.0 * val * val2) + (2.0 * (-source2[1] * val + -source2[2]) * val3);
+	}
+
+	void FilterRecords(tvec vecBest[8], int exp, const tvec records[], int recordCount) {
+		tvec bufferList[8];
+		int buffer1[8];
+		tvec buffer2;
+
+		for (int x = 0; x < 2; x++) {
+			for (int y = 0; y < exp; y++) {
+				buffer1[y] = 0;
+				for (int i = 0; i <= 2; i++)
+					bufferList[y][i] = 0.0;
+			}
+			for (int z = 0; z < recordCount; z++) {
+				int index = 0;
+				double value = 1.0e30;
+				for (int i = 0; i < exp; i++) {
+					double tempVal = ContrastVectors(vecBest[i], records[z]);
+					if (tempVal < value) {
+						value = tempVal;
+						index = i;
+					}
+				}
+				buffer1[index]++;
+				MatrixFilter(records[z], buffer2);
+				for (int i = 0; i <= 2; i++)
+					bufferList[index][i] += buffer2[i];
+			}
+
+			for (int i = 0; i < exp; i++)
+				if (buffer1[i] > 0)
+					for (int y = 0; y <= 2; y++)
+						bufferList[i][y] /= buffer1[i];
+
+			for (int i = 0; i < exp; i++)
+				MergeFinishRecord(bufferList[i], vecBest[i]);
+		}
+	}
+
+	int16_t RoundCoef(double d) {
+		if (d > 0.0)
+			return (d > 32767.0) ? (int16_t)32767 : (int16_t)lround(d);
+		return (d < -32768.0) ? (int16_t)-32768 : (int16_t)lround(d);
+	}
+
+	inline int Clamp16(int v) {
+		return v >= 32767 ? 32767 : v <= -32768 ? -32768 : v;
+	}
+
+	//v / 2^shift rounded to the nearest integer, halves towards zero: the same as the
+	//original's (int)((double)v / (1 << scale) / 2048 +- 0.4999999f) for every int v and
+	//shift <= 23, where the double arithmetic is exact, but without the conversions
+	inline int RoundShift(int v, int shift) {
+		int64_t bias = ((int64_t)1 << (shift - 1)) - 1;
+		return v > 0 ? (int)(((int64_t)v + bias) >> shift) : -(int)((-(int64_t)v + bias) >> shift);
+	}
+
+	//DSPEncodeFrame from gc-dspadpcm-encode. COUNT is 14 for whole frames, so their loops
+	//have fixed trip counts; 0 takes the sample count from count, for a stream's last frame.
+	template <int COUNT>
+	inline void EncodeFrame(int16_t* pcmInOut, int count, uint8_t* adpcmOut, const int16_t* coefs) {
+		const int sampleCount = COUNT > 0 ? COUNT : count;
+		int inSamples[8][16];
+		int outSamples[8][14];
+		int scale[8];
+		int64_t distAccum[8];
+
+		for (int i = 0; i < 8; i++) {
+			const int c1 = coefs[i * 2], c2 = coefs[i * 2 + 1];
+			int v1, v2, v3;
+			int distance = 0, index;
+
+			inSamples[i][0] = pcmInOut[0];
+			inSamples[i][1] = pcmInOut[1];
+
+			for (int s = 0; s < sampleCount; s++) {
+				inSamples[i][s + 2] = v1 = ((pcmInOut[s] * c2) + (pcmInOut[s + 1] * c1)) / 2048;
+				v2 = pcmInOut[s + 2] - v1;
+				v3 = Clamp16(v2);
+				if (abs(v3) > abs(distance))
+					distance = v3;
+			}
+
+			for (scale[i] = 0; (scale[i] <= 12) && ((distance > 7) || (distance < -8)); scale[i]++, distance /= 2) {}
+			scale[i] = (scale[i] <= 1) ? -1 : scale[i] - 2;
+
+			do {
+				scale[i]++;
+				distAccum[i] = 0;
+				index = 0;
+
+				for (int s = 0; s < sampleCount; s++) {
+					v1 = ((inSamples[i][s] * c2) + (inSamples[i][s + 1] * c1));
+					v2 = pcmInOut[s + 2] * 2048 - v1;
+					v3 = RoundShift(v2, scale[i] + 11);
+
+					if (v3 < -8) {
+						if (index < (v3 = -8 - v3))
+							index = v3;
+						v3 = -8;
+					} else if (v3 > 7) {
+						if (index < (v3 -= 7))
+							index = v3;
+						v3 = 7;
+					}
+
+					outSamples[i][s] = v3;
+
+					v1 = (v1 + v3 * (1 << scale[i]) * 2048 + 1024) >> 11;
+					inSamples[i][s + 2] = v2 = Clamp16(v1);
+					v3 = pcmInOut[s + 2] - v2;
+					distAccum[i] += (int64_t)v3 * v3;
+				}
+
+				for (int x = index + 8; x > 256; x >>= 1)
+					if (++scale[i] >= 12)
+						scale[i] = 11;
+
+			} while ((scale[i] < 12) && (index > 1));
+		}
+
+		//Sums of squared integer errors, which the original adds up exactly in doubles
+		int bestIndex = 0;
+		for (int i = 1; i < 8; i++)
+			if (distAccum[i] < distAccum[bestIndex])
+				bestIndex = i;
+
+		for (int s = 0; s < sampleCount; s++)
+			pcmInOut[s + 2] = (int16_t)inSamples[bestIndex][s + 2];
+
+		adpcmOut[0] = (uint8_t)((bestIndex << 4) | (scale[bestIndex] & 0xF));
+
+		for (int s = sampleCount; s < 14; s++)
+			outSamples[bestIndex][s] = 0;
+
+		for (int y = 0; y < 7; y++)
+			adpcmOut[y + 1] = (uint8_t)((outSamples[bestIndex][y * 2] * 16) | (outSamples[bestIndex][y * 2 + 1] & 0xF));
+	}
+}
+
+void dspadpcm::correlate_coefs(const int16_t* source, int samples, int16_t* coefsOut) {
+	int numFrames = (samples + 13) / 14;
+	int frameSamples;
+
+	std::vector<int16_t> blockBuffer(0x3800);
+	int16_t pcmHistBuffer[2][14] = {};
+
+	tvec vec1;
+	tvec vec2;
+
+	tvec mtx[3];
+	int vecIdxs[3];
+
+	std::vector<double> recordBuffer((size_t)numFrames * 2 * 3 + 3);
+	tvec* records = (tvec*)recordBuffer.data();
+	int recordCount = 0;
+
+	tvec vecBest[8];
+
+	for (int x = samples; x > 0;) {
+		if (x > 0x3800) {
+			frameSamples = 0x3800;
+			x -= 0x3800;
+		} else {
+			frameSamples = x;
+			for (int z = 0; z < 14 && z + frameSamples < 0x3800; z++)
+				blockBuffer[frameSamples + z] = 0;
+			x = 0;
+		}
+
+		memcpy(blockBuffer.data(), source, frameSamples * sizeof(int16_t));
+		source += frameSamples;
+
+		for (int i = 0; i < frameSamples;) {
+			for (int z = 0; z < 14; z++)
+				pcmHistBuffer[0][z] = pcmHistBuffer[1][z];
+			for (int z = 0; z < 14; z++)
+				pcmHistBuffer[1][z] = blockBuffer[i++];
+
+			InnerProductMerge(vec1, pcmHistBuffer[1]);
+			if (fabs(vec1[0]) > 10.0) {
+				OuterProductMerge(mtx, pcmHistBuffer[1]);
+				if (!AnalyzeRanges(mtx, vecIdxs)) {
+					BidirectionalFilter(mtx, vecIdxs, vec1);
+					if (!QuadraticMerge(vec1)) {
+						FinishRecord(vec1, records[recordCount]);
+						recordCount++;
+					}
+				}
+			}
+		}
+	}
+
+	vec1[0] = 1.0;
+	vec1[1] = 0.0;
+	vec1[2] = 0.0;
+
+	for (int z = 0; z < recordCount; z++) {
+		MatrixFilter(records[z], vecBest[0]);
+		for (int y = 1; y <= 2; y++)
+			vec1[y] += vecBest[0][y];
+	}
+	for (int y = 1; y <= 2; y++)
+		vec1[y] /= recordCount;
+
+	MergeFinishRecord(vec1, vecBest[0]);
+
+	int exp = 1;
+	for (int w = 0; w < 3;) {
+		vec2[0] = 0.0;
+		vec2[1] = -1.0;
+		vec2[2] = 0.0;
+		for (int i = 0; i < exp; i++)
+			for (int y = 0; y <= 2; y++)
+				vecBest[exp + i][y] = (0.01 * vec2[y]) + vecBest[i][y];
+		++w;
+		exp = 1 << w;
+		FilterRecords(vecBest, exp, records, recordCount);
+	}
+
+	for (int z = 0; z < 8; z++) {
+		coefsOut[z * 2] = RoundCoef(-vecBest[z][1] * 2048.0);
+		coefsOut[z * 2 + 1] = RoundCoef(-vecBest[z][2] * 2048.0);
+	}
+}
+
+void dspadpcm::encode_frame(int16_t* pcmInOut, int count, uint8_t* out, const int16_t* coefs) {
+	if (count == 14)
+		EncodeFrame<14>(pcmInOut, 14, out, coefs);
+	else
+		EncodeFrame<0>(pcmInOut, count, out, coefs);
+}
+
+void dspadpcm::encode_frames(int16_t* pcmInOut, int samples, uint8_t* out, const int16_t* coefs) {
+	//A frame's bytes and reconstruction depend only on its history, its samples and the
+	//coefficients, so a frame whose 16 inputs repeat the last encoded one's gets the same
+	//result without the search. Digital silence and steady DC settle into that within a
+	//frame or two of starting, once the reconstruction stops changing the history.
+	int16_t lastInput[16], lastOutput[14];
+	uint8_t lastFrame[8];
+	bool haveLast = false;
+
+	int i = 0;
+	for (; i + 14 <= samples; i += 14, out += 8) {
+		int16_t* frame = pcmInOut + i;
+		if (haveLast && !memcmp(frame, lastInput, sizeof(lastInput))) {
+			memcpy(out, lastFrame, sizeof(lastFrame));
+			memcpy(frame + 2, lastOutput, sizeof(lastOutput));
+			continue;
+		}
+
+		memcpy(lastInput, frame, sizeof(lastInput));
+		EncodeFrame<14>(frame, 14, out, coefs);
+		memcpy(lastFrame, out, sizeof(lastFrame));
+		memcpy(lastOutput, frame + 2, sizeof(lastOutput));
+		haveLast = true;
+	}
+	if (i < samples)
+		EncodeFrame<0>(pcmInOut + i, samples - i, out, coefs);
+}
+
+void dspadpcm::decode_frame(const uint8_t* frame, const int16_t* coefs, int count, int16_t* out, int* yn1, int* yn2) {
+	int scale = 1 << (frame[0] & 0xF);
+	int c1 = coefs[(frame[0] >> 4 & 7) * 2];
+	int c2 = coefs[(frame[0] >> 4 & 7) * 2 + 1];
+	int h1 = *yn1, h2 = *yn2;
+
+	for (int s = 0; s < count; s++) {
+		int nibble = s % 2 == 0 ? frame[1 + s / 2] >> 4 : frame[1 + s / 2] & 0xF;
+		if (nibble >= 8) nibble -= 16;
+
+		int v = (c1 * h1 + c2 * h2 + nibble * scale * 2048 + 1024) >> 11;
+		v = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+		out[s] = (int16_t)v;
+		h2 = h1;
+		h1 = v;
+	}
+
+	*yn1 = h1;
+	*yn2 = h2;
+}
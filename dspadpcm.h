@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+
+namespace rstmcpp {
+	namespace dspadpcm {
+		// The DSP-ADPCM encoder, bit-compatible with gc-dspadpcm-encode (DSPCorrelateCoefs and
+		// DSPEncodeFrame), which it was ported from.
+
+		// Calculates the 8 predictor coefficient pairs (16 values) that best fit samples.
+		void correlate_coefs(const int16_t* source, int samples, int16_t* coefsOut);
+
+		// Encodes one frame of count samples (at most 14) into 8 bytes at out. pcmInOut holds
+		// the two history samples (yn2, yn1) followed by the frame; the frame is overwritten
+		// with what a decoder will reconstruct, which is the next frame's history.
+		void encode_frame(int16_t* pcmInOut, int count, uint8_t* out, const int16_t* coefs);
+
+		// Encodes consecutive frames, as encode_frame would one at a time: pcmInOut holds two
+		// history samples and then samples samples, out receives (samples + 13) / 14 * 8 bytes.
+		// Whole frames go through a kernel with the frame length fixed at compile time, and a
+		// frame whose history and samples repeat the previous frame's (silence, DC) is copied.
+		void encode_frames(int16_t* pcmInOut, int samples, uint8_t* out, const int16_t* coefs);
+
+		// Decodes the first count samples (at most 14) of one 8-byte DSP-ADPCM frame with the
+		// channel's 16 coefficients. yn1 and yn2 hold the last two decoded samples and are
+		// updated, so consecutive frames can be decoded by calling this in a loop. Matches the
+		// reconstruction encode_frame leaves in its input.
+		void decode_frame(const uint8_t* frame, const int16_t* coefs, int count, int16_t* out, int* yn1, int* yn2);
+	}
+}
@@ -3,8 +3,13 @@
 #include "cwav.h"
 #include "cstm.h"
 #include "rstm.h"
-#include "grok.h"
+#include "dspadpcm.h"
+#include "hash.h"
+#include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
 #include <iostream>
 #include <vector>
 
@@ -15,95 +20,521 @@ using std::cerr;
 using namespace rstmcpp;
 using namespace rstmcpp::pcm16;
 
-void EncodeBlock(int16_t* source, int samples, uint8_t* dest, int16_t* coefs) {
-	for (int i = 0; i < samples; i += 14, source += 14, dest += 8) {
+void EncodeBlock(int16_t* source, int samples, uint8_t* dest, int16_t* coefs, QualityReport* report = nullptr, int channel = 0, int sampleIndex = 0) {
+	if (report == nullptr) {
+		dspadpcm::encode_frames(source, samples, dest, coefs);
+		return;
+	}
+
+	//The encoder overwrites the input with its reconstruction
+	int16_t original[0x3800];
+	memcpy(original, source + 2, samples * sizeof(int16_t));
+	dspadpcm::encode_frames(source, samples, dest, coefs);
+	for (int i = 0; i < samples; i += 14) {
 		int s = samples - i;
 		if (s > 14) s = 14;
-		DSPEncodeFrame(source, s, dest, coefs);
+		report->add(channel, sampleIndex + i, original + i, source + 2 + i, s);
 	}
 }
 
-char* encoder::encode(PCM16* stream, ProgressTracker* progress, int* sizeOut, int type) {
-    switch(type) {
-        case FileType::RSTM:
-            return (char*)encode_rstm(stream, progress, sizeOut);
-        case FileType::CSTM:
-            return (char*)encode_cstm(stream, progress, sizeOut);
-        case FileType::CWAV:
-            return (char*)encode_cwav(stream, progress, sizeOut);
-    }
-    return NULL;
+//Frames per run when estimating coefficients from part of a channel. Long enough that the
+//one frame per run analysed with the wrong history doesn't matter.
+const int ANALYSIS_RUN_FRAMES = 64;
+
+//Copies runs of frames spread over the channel into out, for options->analysisFrames.
+//Returns false if the channel is short enough to be analysed in full.
+bool SampleFrames(const int16_t* source, int samples, const encoder::EncodeOptions* options, vector<int16_t>& out) {
+	int budget = options != nullptr ? options->analysisFrames : 0;
+	int totalFrames = (samples + 13) / 14;
+	int runs = (budget + ANALYSIS_RUN_FRAMES - 1) / ANALYSIS_RUN_FRAMES;
+	if (budget <= 0 || runs * ANALYSIS_RUN_FRAMES * 2 > totalFrames)
+		return false;
+
+	out.clear();
+	out.reserve(runs * ANALYSIS_RUN_FRAMES * 14);
+	for (int r = 0; r < runs; r++) {
+		//One run from each of runs equal parts, in frames
+		int lo = (int)((int64_t)totalFrames * r / runs);
+		int hi = (int)((int64_t)totalFrames * (r + 1) / runs);
+		int start = lo + (hi - lo - ANALYSIS_RUN_FRAMES) / 2;
+
+		if (options->analysisByEnergy) {
+			int64_t best = -1;
+			for (int f = lo; f + ANALYSIS_RUN_FRAMES <= hi; f += ANALYSIS_RUN_FRAMES) {
+				int end = (f + ANALYSIS_RUN_FRAMES) * 14 < samples ? (f + ANALYSIS_RUN_FRAMES) * 14 : samples;
+				int64_t energy = 0;
+				for (int i = f * 14; i < end; i++)
+					energy += source[i] * source[i];
+				if (energy > best) {
+					best = energy;
+					start = f;
+				}
+			}
+		}
+
+		int from = start * 14;
+		int to = (start + ANALYSIS_RUN_FRAMES) * 14 < samples ? (start + ANALYSIS_RUN_FRAMES) * 14 : samples;
+		out.insert(out.end(), source + from, source + to);
+	}
+	return true;
 }
 
-CWAVHeader* encoder::encode_cwav(PCM16* stream, ProgressTracker* progress, int* sizeOut) {
-    int tmp;
-	bool looped = stream->looping;
+//Encodes a copy of one channel with the given coefficients and measures the error
+QualityReport::Stats TrialEncode(const int16_t* source, int samples, const int16_t* coefs) {
+	vector<int16_t> buffer(samples + 2, 0);
+	memcpy(buffer.data() + 2, source, samples * sizeof(int16_t));
+
+	vector<uint8_t> frames((samples + 13) / 14 * 8);
+	dspadpcm::encode_frames(buffer.data(), samples, frames.data(), coefs);
+
+	QualityReport::Stats stats;
+	for (int i = 0; i < samples; i++) {
+		int error = buffer[i + 2] - source[i];
+		stats.signalEnergy += (double)source[i] * source[i];
+		stats.errorEnergy += (double)error * error;
+		if (abs(error) > stats.peakError) stats.peakError = abs(error);
+	}
+	stats.samples += samples;
+	return stats;
+}
+
+void CorrelateCoefs(int16_t* source, int samples, int16_t* coefsOut, const encoder::EncodeOptions* options, int channel = 0) {
+	vector<int16_t> sampled;
+	bool estimate = SampleFrames(source, samples, options, sampled);
+	const int16_t* analysed = estimate ? sampled.data() : source;
+	int analysedSamples = estimate ? (int)sampled.size() : samples;
+
+	CoefCache* cache = options != nullptr ? options->coefCache : nullptr;
+	if (cache == nullptr) {
+		dspadpcm::correlate_coefs(analysed, analysedSamples, coefsOut);
+	} else {
+		//Estimates are keyed on the whole channel plus the settings that chose the frames
+		uint64_t key = CoefCache::key(source, samples);
+		if (estimate) {
+			le_int32_t settings[2];
+			settings[0] = options->analysisFrames;
+			settings[1] = options->analysisByEnergy;
+			key = hash::hash64(settings, sizeof(settings), key);
+		}
+		if (!cache->get(key, coefsOut)) {
+			dspadpcm::correlate_coefs(analysed, analysedSamples, coefsOut);
+			cache->put(key, coefsOut);
+		}
+	}
+
+	if (estimate && options->report != nullptr) {
+		int16_t full[16];
+		dspadpcm::correlate_coefs(source, samples, full);
+		options->report->set_analysis(channel, TrialEncode(source, samples, coefsOut), TrialEncode(source, samples, full));
+	}
+}
+
+int16_t* encoder::Workspace::channel_buffer(int channel, int samples) {
+	if ((int)channelBuffers.size() <= channel)
+		channelBuffers.resize(channel + 1);
+	if ((int)channelBuffers[channel].size() < samples)
+		channelBuffers[channel].resize(samples);
+	return channelBuffers[channel].data();
+}
+
+void* encoder::Workspace::scratch(size_t size) {
+	if (scratchBuffer.size() < size)
+		scratchBuffer.resize(size);
+	return scratchBuffer.data();
+}
+
+int16_t* AllocChannelBuffer(int channel, int samples, const encoder::EncodeOptions* options) {
+	if (options != nullptr && options->workspace != nullptr)
+		return options->workspace->channel_buffer(channel, samples);
+	return (int16_t*)malloc(samples * 2); //Two bytes per sample
+}
+
+void FreeChannelBuffer(int16_t* buffer, const encoder::EncodeOptions* options) {
+	if (options == nullptr || options->workspace == nullptr)
+		free(buffer);
+}
+
+//Copies frames of interleaved samples into per-channel buffers. The channel count is a
+//template parameter for the common layouts so the inner loop has a constant stride;
+//CHANNELS = 0 is the generic version.
+template <int CHANNELS>
+void DeinterleaveRun(const int16_t* src, int16_t* const* buffers, int offset, int frames, int channels) {
+	const int n = CHANNELS > 0 ? CHANNELS : channels;
+	for (int x = 0; x < n; x++) {
+		const int16_t* s = src + x;
+		int16_t* d = buffers[x] + offset;
+		for (int i = 0; i < frames; i++)
+			d[i] = s[i * n];
+	}
+}
+
+//Mixes frames of interleaved samples into per-channel buffers through a channel matrix.
+//Outputs that are a single input at unity weight are copied instead.
+void MatrixRun(const int16_t* src, int16_t* const* buffers, int offset, int frames, const ChannelMatrix* matrix) {
+	const int n = matrix->inputs;
+	float mix[0x1000];
+	for (int x = 0; x < matrix->outputs; x++) {
+		int16_t* d = buffers[x] + offset;
+		int terms = 0, only = 0;
+		for (int j = 0; j < n; j++) {
+			if (matrix->weight(x, j) != 0) {
+				terms++;
+				only = j;
+			}
+		}
+
+		if (terms == 1 && matrix->weight(x, only) == 1) {
+			const int16_t* s = src + only;
+			for (int i = 0; i < frames; i++)
+				d[i] = s[i * n];
+			continue;
+		}
+
+		for (int i = 0; i < frames; i++)
+			mix[i] = 0;
+		for (int j = 0; j < n; j++) {
+			float w = matrix->weight(x, j);
+			if (w == 0) continue;
+			const int16_t* s = src + j;
+			for (int i = 0; i < frames; i++)
+				mix[i] += w * s[i * n];
+		}
+		for (int i = 0; i < frames; i++) {
+			float v = floorf(mix[i] + 0.5f);
+			d[i] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+		}
+	}
+}
+
+//Number of channels in the encoded output
+int OutputChannels(const PCM16* stream, const encoder::EncodeOptions* options) {
+	if (options == nullptr || options->matrix == nullptr)
+		return stream->channels;
+	if (options->matrix->inputs != stream->channels)
+		throw std::invalid_argument("Channel map is for " + std::to_string(options->matrix->inputs) + " channels, but the input has " + std::to_string(stream->channels));
+	return options->matrix->outputs;
+}
+
+void ApplyGain(int16_t* samples, int count, double gain) {
+	for (int i = 0; i < count; i++) {
+		double v = floor(samples[i] * gain + 0.5);
+		samples[i] = (int16_t)(v > 32767 ? 32767 : v < -32768 ? -32768 : v);
+	}
+}
+
+//Reads count frames from the start of the stream into buffers[x][offset...], jumping back to
+//the loop start whenever the loop end is reached (the same samples readSamples would return).
+//Uses its own cursor and leaves the stream untouched, so several encodes can share one stream.
+//Each chunk is measured and scaled right after it is copied, while it is still in cache; only
+//the first meterFrames frames are measured. trim frames are skipped at the start; with rotate, reading jumps from rotate frames before
+//the loop start to the loop's last rotate frames (see LoopAlignment).
+void Deinterleave(const PCM16* stream, int16_t* const* buffers, int offset, int count, LevelMeter* meter = nullptr, int meterFrames = 0, double gain = 1, const ChannelMatrix* matrix = nullptr, int trim = 0, int rotate = 0) {
 	int channels = stream->channels;
-	int samples;
-	int blocks;
-	int sampleRate = stream->sampleRate;
-	int lbSamples, lbSize, lbTotal;
-	int loopPadding, loopStart, totalSamples;
-	int16_t* tPtr;
+	int outputs = matrix != nullptr ? matrix->outputs : channels;
+	void (*run)(const int16_t*, int16_t* const*, int, int, int);
+	switch (channels) {
+		case 1: run = DeinterleaveRun<1>; break;
+		case 2: run = DeinterleaveRun<2>; break;
+		case 4: run = DeinterleaveRun<4>; break;
+		case 6: run = DeinterleaveRun<6>; break;
+		default: run = DeinterleaveRun<0>; break;
+	}
 
-    int blockSize = 0x3800;
+	const int16_t* pos = stream->samples + (ptrdiff_t)trim * channels;
+	const int16_t* end = stream->looping ? stream->loop_end : stream->samples_end;
+	if (end > stream->samples_end) end = stream->samples_end;
+	const int16_t* jumpFrom = nullptr;
+	const int16_t* jumpTo = nullptr;
+	int loopFrames = (int)((stream->loop_end - stream->loop_start) / channels);
+	if (rotate > 0 && loopFrames > 0) {
+		jumpFrom = stream->loop_start - (ptrdiff_t)rotate * channels;
+		jumpTo = stream->loop_start + (ptrdiff_t)((loopFrames - rotate % loopFrames) % loopFrames) * channels;
+	}
+	while (count > 0) {
+		if (stream->looping && pos == stream->loop_end)
+			pos = stream->loop_start;
+		if (pos == jumpFrom) {
+			pos = jumpTo;
+			jumpFrom = nullptr;
+		}
 
-	if (looped)
+		int frames = (int)(((jumpFrom != nullptr ? jumpFrom : end) - pos) / channels);
+		if (frames > count) frames = count;
+		if (frames > 0x1000) frames = 0x1000;
+		if (frames <= 0) {
+			//Ran out of input; repeat the last frame like a short read would
+			for (int x = 0; x < outputs; x++) {
+				int16_t last = offset > 0 ? buffers[x][offset - 1] : 0;
+				for (int i = 0; i < count; i++)
+					buffers[x][offset + i] = last;
+			}
+			break;
+		}
+
+		if (matrix != nullptr)
+			MatrixRun(pos, buffers, offset, frames, matrix);
+		else
+			run(pos, buffers, offset, frames, channels);
+		int measure = frames < meterFrames ? frames : meterFrames;
+		for (int x = 0; x < outputs; x++) {
+			if (meter != nullptr && measure > 0) meter->add(x, buffers[x] + offset, measure);
+			if (gain != 1) ApplyGain(buffers[x] + offset, frames, gain);
+		}
+		meterFrames -= measure;
+		pos += frames * channels;
+		offset += frames;
+		count -= frames;
+	}
+}
+
+//Fills the channel buffers (after the two initial yn values) with the stream's samples,
+//measuring and scaling them as the options ask. The last padding samples repeat the loop
+//start (LoopAlignment::PAD) and are left out of the levels.
+void FillChannelBuffers(const PCM16* stream, int16_t* const* buffers, int totalSamples, const encoder::EncodeOptions* options, int trim, int rotate, int padding) {
+	if (options == nullptr) {
+		Deinterleave(stream, buffers, 2, totalSamples, nullptr, 0, 1, nullptr, trim, rotate);
+		return;
+	}
+	int channels = OutputChannels(stream, options);
+
+	LevelMeter localMeter;
+	LevelMeter* meter = options->levels;
+	if (meter == nullptr && options->normalize) meter = &localMeter;
+	if (meter != nullptr) meter->begin(channels, stream->sampleRate);
+
+	double gain = options->normalize ? 1 : options->gain;
+	Deinterleave(stream, buffers, 2, totalSamples, meter, totalSamples - padding, gain, options->matrix, trim, rotate);
+
+	if (options->normalize) {
+		//Needs the loudness of the whole input, so this one is a second pass over the buffers
+		double loudness = meter->loudness();
+		gain = std::isfinite(loudness) ? pow(10.0, (options->targetLoudness - loudness) / 20) : 1;
+		int peak = 0;
+		for (int x = 0; x < channels; x++)
+			if (meter->peak(x) > peak) peak = meter->peak(x);
+		if (peak > 0 && gain * peak > 32767)
+			gain = 32767.0 / peak;
+		if (gain != 1) {
+			for (int x = 0; x < channels; x++)
+				ApplyGain(buffers[x] + 2, totalSamples, gain);
+		}
+	}
+	if (meter != nullptr) meter->gain = gain;
+}
+
+//Rounds up to a multiple of 0x20, which every section and padded block is aligned to
+int Align32(int size) {
+	return (size + 0x1F) & ~0x1F;
+}
+
+//samples is where the input ends, or where the loop ends if looped
+encoder::Layout encoder::plan_layout(int type, int channels, int samples, int loopStart, int alignment) {
+	if (type != FileType::RSTM && type != FileType::CSTM && type != FileType::CWAV)
+		throw std::invalid_argument("Unsupported output format");
+
+	Layout l;
+	int tmp;
+
+	l.type = type;
+	l.channels = channels;
+	l.looped = loopStart >= 0;
+	l.trimSamples = l.rotateSamples = 0;
+	if (l.looped)
 	{
-		loopStart = (stream->loop_start - stream->samples) / stream->channels;
-		samples = (stream->loop_end - stream->samples) / stream->channels; //Set sample size to end sample. That way the audio gets cut off when encoding.
+		if (alignment != LoopAlignment::PAD && alignment != LoopAlignment::TRIM && alignment != LoopAlignment::ROTATE)
+			throw std::invalid_argument("Unknown loop alignment");
+
+		if (loopStart >= samples)
+			throw std::invalid_argument("Loop start must be before the loop end");
+
+		l.loopStart = loopStart;
+		l.loopPadding = 0;
 
-		//If loop point doesn't land on a block, pad the stream so that it does.
-		if ((tmp = loopStart % blockSize) != 0)
+		//If loop point doesn't land on a block, pad the stream so that it does, or move
+		//the loop back to the block it's in.
+		if ((tmp = l.loopStart % 0x3800) != 0)
 		{
-			loopPadding = blockSize - tmp;
-			loopStart += loopPadding;
-		} else
-			loopPadding = 0;
+			if (alignment == LoopAlignment::TRIM)
+				l.trimSamples = tmp;
+			else if (alignment == LoopAlignment::ROTATE)
+				l.rotateSamples = tmp;
+			else
+				l.loopPadding = 0x3800 - tmp;
+			l.loopStart += l.loopPadding - l.trimSamples - l.rotateSamples;
+		}
 
-		totalSamples = loopPadding + samples;
+		l.totalSamples = l.loopPadding + samples - l.trimSamples - l.rotateSamples;
 	} else
 	{
-		loopPadding = loopStart = 0;
-		totalSamples = samples = (stream->samples_end - stream->samples) / stream->channels;
+		l.loopPadding = l.loopStart = 0;
+		l.totalSamples = samples;
 	}
 
-	if (progress != nullptr)
-		progress->begin(0, totalSamples * channels * 3, 0);
-
-	blocks = (totalSamples + blockSize - 1) / blockSize;
+	l.samplesPerBlock = 0x3800;
+	l.blockSize = 0x2000;
+	l.blocks = (l.totalSamples + 0x37FF) / 0x3800;
 
-	//Initialize stream info
-	if ((tmp = totalSamples % blockSize) != 0)
+	if ((tmp = l.totalSamples % 0x3800) != 0)
 	{
-		lbSamples = tmp;
-		lbSize = (lbSamples + 13) / 14 * 8;
-		lbTotal = lbSize;
-		while (lbTotal % 0x20 != 0) lbTotal++; // TODO optimize?
+		l.lastBlockSamples = tmp;
+		l.lastBlockSize = (l.lastBlockSamples + 13) / 14 * 8;
+		l.lastBlockTotal = Align32(l.lastBlockSize);
 	} else
 	{
-		lbSamples = blockSize;
-		lbTotal = lbSize = 0x2000;
+		l.lastBlockSamples = 0x3800;
+		l.lastBlockTotal = l.lastBlockSize = 0x2000;
 	}
+	l.channelDataSize = (l.blocks - 1) * 0x2000 + l.lastBlockTotal;
+
+	//Sections follow the 0x40-byte file header: HEAD/INFO, ADPC/SEEK (not in CWAV), DATA
+	l.headOffset = 0x40;
+	if (type == FileType::CWAV) {
+		//Always padded, even when the packed size is already a multiple of 0x20
+		int infoPackedSize = sizeof(le_uint32_t) * 2 + sizeof(CWAVDataInfo) + channels * (sizeof(CWAVReference) + sizeof(CWAVChannelInfo));
+		l.headSize = infoPackedSize + 0x0020 - infoPackedSize % 0x0020;
+		l.historyOffset = l.historySize = 0;
+	} else {
+		l.headSize = Align32(0x68 + (channels * 0x40));
+		l.historyOffset = l.headOffset + l.headSize;
+		l.historySize = Align32((l.blocks - 1) * 4 * channels + 0x10);
+	}
+	l.dataOffset = l.headOffset + l.headSize + l.historySize;
+	l.dataSize = l.channelDataSize * channels + 0x20;
+	l.payloadOffset = l.dataOffset + 0x20;
+	l.fileSize = l.dataOffset + l.dataSize;
+	return l;
+}
 
-    unsigned chanBlocks = ((lbSize / 8) + 4095) / 4096;
+encoder::Layout encoder::plan_layout(const PCM16* stream, int type, const EncodeOptions* options) {
+	int channels = OutputChannels(stream, options);
+	if (stream->looping) {
+		int alignment = options != nullptr ? options->loopAlignment : LoopAlignment::PAD;
+		//Set sample size to end sample. That way the audio gets cut off when encoding.
+		return plan_layout(type, channels, (int)((stream->loop_end - stream->samples) / stream->channels),
+			(int)((stream->loop_start - stream->samples) / stream->channels), alignment);
+	}
+	return plan_layout(type, channels, (int)((stream->samples_end - stream->samples) / stream->channels));
+}
 
-	//Get section sizes
-	int cwavSize = 0x40;
-    int infoPackedSize = sizeof(le_uint32_t) * 2 + sizeof(CWAVDataInfo) + channels * (sizeof(CWAVReference) + sizeof(CWAVChannelInfo));
-    int infoSize = infoPackedSize + 0x0020 - infoPackedSize % 0x0020;
-	int dataSize = ((blocks - 1) * 0x2000 + lbTotal) * channels + 0x20;
+//Lays out an RSTM's sections at address and fills in everything that doesn't depend on the
+//encoded samples. Clears everything before the DATA payload; the payload itself is left as is.
+void SetRstmHeaders(void* address, const encoder::Layout& l, int sampleRate) {
+	int channels = l.channels;
+	memset(address, 0, l.payloadOffset);
 
+	//Get section pointers
+	RSTMHeader* rstm = (RSTMHeader*)address;
+	HEADHeader* head = (HEADHeader*)((uint8_t*)rstm + l.headOffset);
+	ADPCHeader* adpc = (ADPCHeader*)((uint8_t*)rstm + l.historyOffset);
+	RSTMDATAHeader* data = (RSTMDATAHeader*)((uint8_t*)rstm + l.dataOffset);
+
+	//Initialize sections
+	rstm->Set(l.headSize, l.historySize, l.dataSize);
+	head->Set(l.headSize, channels);
+	adpc->Set(l.historySize);
+	data->Set(l.dataSize);
+
+	//Set HEAD data
+	StrmDataInfo* part1 = head->Part1();
+	part1->_format = AudioFormatInfo(2, (uint8_t)(l.looped ? 1 : 0), (uint8_t)channels, 0);
+	part1->_sampleRate = (uint16_t)sampleRate;
+	part1->_blockHeaderOffset = 0;
+	part1->_loopStartSample = l.loopStart;
+	part1->_numSamples = l.totalSamples;
+	part1->_dataOffset = l.payloadOffset;
+	part1->_numBlocks = l.blocks;
+	part1->_blockSize = l.blockSize;
+	part1->_samplesPerBlock = l.samplesPerBlock;
+	part1->_lastBlockSize = l.lastBlockSize;
+	part1->_lastBlockSamples = l.lastBlockSamples;
+	part1->_lastBlockTotal = l.lastBlockTotal;
+	part1->_dataInterval = 0x3800;
+	part1->_bitsPerSample = 4;
+
+	//Create one ADPCMInfo for each channel
+	for (int i = 0; i < channels; i++)
+	{
+		ADPCMInfo* p = head->GetChannelInfo(i);
+		*p = ADPCMInfo();
+		p->_pad = 0;
+	}
+}
+
+int encoder::get_size(const PCM16* stream, int type, const EncodeOptions* options) {
+	return plan_layout(stream, type, options).fileSize;
+}
+
+int encoder::get_rstm_size(int channels, int totalSamples) {
+	return plan_layout(FileType::RSTM, channels, totalSamples).fileSize;
+}
+
+void encoder::write_rstm_headers(void* dest, int channels, int sampleRate, int totalSamples) {
+	SetRstmHeaders(dest, plan_layout(FileType::RSTM, channels, totalSamples), sampleRate);
+}
+
+char* encoder::encode(const PCM16* stream, ProgressTracker* progress, int* sizeOut, int type, const EncodeOptions* options) {
+    switch(type) {
+        case FileType::RSTM:
+            return (char*)encode_rstm(stream, progress, sizeOut, options);
+        case FileType::CSTM:
+            return (char*)encode_cstm(stream, progress, sizeOut, options);
+        case FileType::CWAV:
+            return (char*)encode_cwav(stream, progress, sizeOut, options);
+    }
+    return NULL;
+}
+
+void encoder::encode_to_ptr(const PCM16* stream, ProgressTracker* progress, int type, void* dest, const EncodeOptions* options) {
+    switch(type) {
+        case FileType::RSTM:
+            encode_rstm_to(stream, progress, dest, options);
+            break;
+        case FileType::CSTM:
+            encode_cstm_to(stream, progress, dest, options);
+            break;
+        case FileType::CWAV:
+            encode_cwav_to(stream, progress, dest, options);
+            break;
+        default:
+            throw std::invalid_argument("Unsupported output format");
+    }
+}
+
+CWAVHeader* encoder::encode_cwav(const PCM16* stream, ProgressTracker* progress, int* sizeOut, const EncodeOptions* options) {
+	int size = get_size(stream, FileType::CWAV, options);
 	if (sizeOut != nullptr) {
-		*sizeOut = cwavSize + infoSize + dataSize;
+		*sizeOut = size;
 	}
-	void* address = malloc(cwavSize + infoSize + dataSize);
-	memset(address, 0, cwavSize + infoSize + dataSize);
+	void* address = malloc(size);
+	encode_cwav_to(stream, progress, address, options);
+	return (CWAVHeader*)address;
+}
+
+void encoder::encode_cwav_to(const PCM16* stream, ProgressTracker* progress, void* address, const EncodeOptions* options) {
+    int tmp;
+	int channels = OutputChannels(stream, options);
+	int sampleRate = stream->sampleRate;
+	int16_t* tPtr;
+
+    int blockSize = 0x3800;
+
+	Layout g = plan_layout(stream, FileType::CWAV, options);
+	bool looped = g.looped;
+	int loopStart = g.loopStart, loopPadding = g.loopPadding, totalSamples = g.totalSamples;
+	int blocks = g.blocks;
+	int lbSize = g.lastBlockSize, lbTotal = g.lastBlockTotal;
+
+	if (progress != nullptr)
+		progress->begin(0, totalSamples * channels * 3, 0);
+
+	//Get section sizes
+	int infoSize = g.headSize, dataSize = g.dataSize;
+	memset(address, 0, g.fileSize);
 
 	//Get section pointers
 	CWAVHeader* cwav = (CWAVHeader*)address;
-	CWAVINFOHeader* info = (CWAVINFOHeader*)((uint8_t*)cwav + cwavSize);
-	CWAVDataHeader* data = (CWAVDataHeader*)((uint8_t*)info + infoSize);
+	CWAVINFOHeader* info = (CWAVINFOHeader*)((uint8_t*)cwav + g.headOffset);
+	CWAVDataHeader* data = (CWAVDataHeader*)((uint8_t*)cwav + g.dataOffset);
 
 	//Set HEAD data
     StrmDataInfo strmDataInfo;
@@ -131,7 +562,7 @@ CWAVHeader* encoder::encode_cwav(PCM16* stream, ProgressTracker* progress, int*
 	int bufferSamples = totalSamples + 2; //Add two samples for initial yn values
 	for (int i = 0; i < channels; i++)
 	{
-		channelBuffers.push_back(tPtr = (int16_t*)malloc(bufferSamples * 2)); //Two bytes per sample
+		channelBuffers.push_back(tPtr = AllocChannelBuffer(i, bufferSamples, options));
 
 		//Zero padding samples and initial yn values
 		for (int x = 0; x < (loopPadding + 2); x++)
@@ -139,29 +570,21 @@ CWAVHeader* encoder::encode_cwav(PCM16* stream, ProgressTracker* progress, int*
 	}
 
 	//Fill buffers
-	stream->samples_pos = stream->samples;
-	int16_t* sampleBuffer = (int16_t*)malloc(channels * sizeof(int16_t*));
+	FillChannelBuffers(stream, channelBuffers.data(), totalSamples, options, g.trimSamples, g.rotateSamples, g.loopPadding);
 
-	for (int i = 2; i < bufferSamples; i++)
-	{
-		if (looped && stream->samples_pos == stream->loop_end)
-			stream->samples_pos = stream->loop_start;
-
-		stream->readSamples(sampleBuffer, 1);
-		for (int x = 0; x < channels; x++)
-			channelBuffers[x][i] = sampleBuffer[x];
-	}
-
-	free(sampleBuffer);
+	QualityReport* report = options != nullptr ? options->report : nullptr;
+	if (report != nullptr)
+		report->begin(channels, sampleRate, totalSamples, g.trimSamples);
 
 	//Calculate coefs
 	for (int i = 0; i < channels; i++) {
-		DSPCorrelateCoefs(channelBuffers[i] + 2, totalSamples, (int16_t*)pAdpcm[i]);
+		CorrelateCoefs(channelBuffers[i] + 2, totalSamples, (int16_t*)pAdpcm[i], options, i);
 		if (progress)
 			progress->update(progress->currentValue + totalSamples);
 	}
 
 	//Encode blocks
+
     //This order is different from brstm.
 	uint8_t* dPtr = (uint8_t*)data->Data();
 
@@ -175,7 +598,7 @@ CWAVHeader* encoder::encode_cwav(PCM16* stream, ProgressTracker* progress, int*
 			int16_t* sPtr = channelBuffers[x] + sIndex;
 
             //Encode block (include yn in sPtr)
-			EncodeBlock(sPtr, blockSamples, dPtr, (int16_t*)pAdpcm[x]);
+			EncodeBlock(sPtr, blockSamples, dPtr, (int16_t*)pAdpcm[x], report, x, sIndex);
 
 			//Set initial ps
 			if (bIndex == 1)
@@ -220,17 +643,25 @@ CWAVHeader* encoder::encode_cwav(PCM16* stream, ProgressTracker* progress, int*
 
 	//Free memory
 	for (int i = 0; i < channels; i++)
-		free(channelBuffers[i]);
+		FreeChannelBuffer(channelBuffers[i], options);
 
 	if (progress != nullptr)
 		progress->finish();
-
-    return cwav;
 }
 
-CSTMHeader* encoder::encode_cstm(PCM16* stream, ProgressTracker* progress, int* sizeOut) {
-    RSTMHeader* rstm = encoder::encode_rstm(stream, progress, sizeOut);
+CSTMHeader* encoder::encode_cstm(const PCM16* stream, ProgressTracker* progress, int* sizeOut, const EncodeOptions* options) {
+	int size = get_size(stream, FileType::CSTM, options);
+	if (sizeOut != nullptr) {
+		*sizeOut = size;
+	}
+	void* address = malloc(size);
+	encode_cstm_to(stream, progress, address, options);
+	return (CSTMHeader*)address;
+}
 
+//Writes the CSTM equivalent of an RSTM's headers to address: everything before the DATA
+//payload, which has the same layout in both formats.
+void ConvertHeaders(RSTMHeader* rstm, void* address) {
     StrmDataInfo* strmDataInfo = rstm->HEADData()->Part1();
     int channels = strmDataInfo->_format._channels;
 
@@ -243,9 +674,7 @@ CSTMHeader* encoder::encode_cstm(PCM16* stream, ProgressTracker* progress, int*
     int seekSize = rstm->_adpcLength;
     int dataSize = rstm->_dataLength;
 
-    //Create byte array
-    void* address = malloc(rstmSize + infoSize + seekSize + dataSize);
-	memset(address, 0, rstmSize + infoSize + seekSize + dataSize);
+	memset(address, 0, rstmSize + infoSize + seekSize + 0x20);
 
     //Get section pointers
     CSTMHeader* cstm = (CSTMHeader*)address;
@@ -274,121 +703,72 @@ CSTMHeader* encoder::encode_cstm(PCM16* stream, ProgressTracker* progress, int*
     {
         *(seekTo++) = *(seekFrom++);
     }
+}
+
+void encoder::rstm_to_cstm(RSTMHeader* rstm, void* address) {
+    CSTMHeader* cstm = (CSTMHeader*)address;
+    ConvertHeaders(rstm, cstm);
 
     uint8_t* dataFrom = (uint8_t*)rstm->DATAData()->Data();
-    uint8_t* dataTo = data->Data();
-    memmove(dataTo, dataFrom, (uint32_t)data->_length - sizeof(uint32_t) * 8);
-    return cstm;
+    uint8_t* dataTo = cstm->DATAData()->Data();
+    memmove(dataTo, dataFrom, (uint32_t)cstm->DATAData()->_length - sizeof(uint32_t) * 8);
 }
 
-RSTMHeader* encoder::encode_rstm(PCM16* stream, ProgressTracker* progress, int* sizeOut) {
-	int tmp;
-	bool looped = stream->looping;
-	int channels = stream->channels;
-	int samples;
-	int blocks;
-	int sampleRate = stream->sampleRate;
-	int lbSamples, lbSize, lbTotal;
-	int loopPadding, loopStart, totalSamples;
-	int16_t* tPtr;
+void encoder::encode_cstm_to(const PCM16* stream, ProgressTracker* progress, void* address, const EncodeOptions* options) {
+    //Encode as BRSTM first, then convert
+    Workspace* workspace = options != nullptr ? options->workspace : nullptr;
+    int rstmTotal = get_size(stream, FileType::RSTM, options);
+    RSTMHeader* rstm = (RSTMHeader*)(workspace != nullptr ? workspace->scratch(rstmTotal) : malloc(rstmTotal));
+    encoder::encode_rstm_to(stream, progress, rstm, options);
 
-	if (looped)
-	{
-		loopStart = (stream->loop_start - stream->samples) / stream->channels;
-		samples = (stream->loop_end - stream->samples) / stream->channels; //Set sample size to end sample. That way the audio gets cut off when encoding.
+    rstm_to_cstm(rstm, address);
 
-		//If loop point doesn't land on a block, pad the stream so that it does.
-		if ((tmp = loopStart % 0x3800) != 0)
-		{
-			loopPadding = 0x3800 - tmp;
-			loopStart += loopPadding;
-		} else
-			loopPadding = 0;
+    if (workspace == nullptr)
+        free(rstm);
+}
 
-		totalSamples = loopPadding + samples;
-	} else
-	{
-		loopPadding = loopStart = 0;
-		totalSamples = samples = (stream->samples_end - stream->samples) / stream->channels;
+RSTMHeader* encoder::encode_rstm(const PCM16* stream, ProgressTracker* progress, int* sizeOut, const EncodeOptions* options) {
+	int size = get_size(stream, FileType::RSTM, options);
+	if (sizeOut != nullptr) {
+		*sizeOut = size;
 	}
+	void* address = malloc(size);
+	encode_rstm_to(stream, progress, address, options);
+	return (RSTMHeader*)address;
+}
 
-	if (progress != nullptr)
-		progress->begin(0, totalSamples * channels * 3, 0);
-
-	blocks = (totalSamples + 0x37FF) / 0x3800;
-
-	//Initialize stream info
-	if ((tmp = totalSamples % 0x3800) != 0)
-	{
-		lbSamples = tmp;
-		lbSize = (lbSamples + 13) / 14 * 8;
-		lbTotal = lbSize;
-		while (lbTotal % 0x20 != 0) lbTotal++; // TODO optimize?
-	} else
-	{
-		lbSamples = 0x3800;
-		lbTotal = lbSize = 0x2000;
-	}
+void encoder::encode_rstm_to(const PCM16* stream, ProgressTracker* progress, void* address, const EncodeOptions* options) {
+	int tmp;
+	int channels = OutputChannels(stream, options);
+	int sampleRate = stream->sampleRate;
+	int16_t* tPtr;
 
-	//Get section sizes
-	int rstmSize = 0x40;
-	int headSize = 0x68 + (channels * 0x40);
-	while (headSize % 0x20 != 0) headSize++;
-	int adpcSize = (blocks - 1) * 4 * channels + 0x10;
-	while (adpcSize % 0x20 != 0) adpcSize++;
-	int dataSize = ((blocks - 1) * 0x2000 + lbTotal) * channels + 0x20;
+	Layout g = plan_layout(stream, FileType::RSTM, options);
+	bool looped = g.looped;
+	int loopStart = g.loopStart, loopPadding = g.loopPadding, totalSamples = g.totalSamples;
+	int blocks = g.blocks;
+	int lbSize = g.lastBlockSize, lbTotal = g.lastBlockTotal;
 
-	if (sizeOut != nullptr) {
-		*sizeOut = rstmSize + headSize + adpcSize + dataSize;
-	}
-	void* address = malloc(rstmSize + headSize + adpcSize + dataSize);
-	memset(address, 0, rstmSize + headSize + adpcSize + dataSize);
+	if (progress != nullptr)
+		progress->begin(0, totalSamples * channels * 3, 0);
 
-	//Get section pointers
+	//Lay out sections and set HEAD data
+	SetRstmHeaders(address, g, sampleRate);
 	RSTMHeader* rstm = (RSTMHeader*)address;
-	HEADHeader* head = (HEADHeader*)((uint8_t*)rstm + rstmSize);
-	ADPCHeader* adpc = (ADPCHeader*)((uint8_t*)head + headSize);
-	RSTMDATAHeader* data = (RSTMDATAHeader*)((uint8_t*)adpc + adpcSize);
+	HEADHeader* head = rstm->HEADData();
+	ADPCHeader* adpc = rstm->ADPCData();
+	RSTMDATAHeader* data = rstm->DATAData();
 
-	//Initialize sections
-	rstm->Set(headSize, adpcSize, dataSize);
-	head->Set(headSize, channels);
-	adpc->Set(adpcSize);
-	data->Set(dataSize);
-
-	//Set HEAD data
-	StrmDataInfo* part1 = head->Part1();
-	part1->_format = AudioFormatInfo(2, (uint8_t)(looped ? 1 : 0), (uint8_t)channels, 0);
-	part1->_sampleRate = (uint16_t)sampleRate;
-	part1->_blockHeaderOffset = 0;
-	part1->_loopStartSample = loopStart;
-	part1->_numSamples = totalSamples;
-	part1->_dataOffset = rstmSize + headSize + adpcSize + 0x20;
-	part1->_numBlocks = blocks;
-	part1->_blockSize = 0x2000;
-	part1->_samplesPerBlock = 0x3800;
-	part1->_lastBlockSize = lbSize;
-	part1->_lastBlockSamples = lbSamples;
-	part1->_lastBlockTotal = lbTotal;
-	part1->_dataInterval = 0x3800;
-	part1->_bitsPerSample = 4;
-
-	//Create one ADPCMInfo for each channel
 	vector<ADPCMInfo*> pAdpcm;
 	for (int i = 0; i < channels; i++)
-	{
-		ADPCMInfo* p = head->GetChannelInfo(i);
-		*p = ADPCMInfo();
-		p->_pad = 0;
-		pAdpcm.push_back(p);
-	}
+		pAdpcm.push_back(head->GetChannelInfo(i));
 
 	//Create buffer for each channel
 	vector<int16_t*> channelBuffers;
 	int bufferSamples = totalSamples + 2; //Add two samples for initial yn values
 	for (int i = 0; i < channels; i++)
 	{
-		channelBuffers.push_back(tPtr = (int16_t*)malloc(bufferSamples * 2)); //Two bytes per sample
+		channelBuffers.push_back(tPtr = AllocChannelBuffer(i, bufferSamples, options));
 
 		//Zero padding samples and initial yn values
 		for (int x = 0; x < (loopPadding + 2); x++)
@@ -396,29 +776,21 @@ RSTMHeader* encoder::encode_rstm(PCM16* stream, ProgressTracker* progress, int*
 	}
 
 	//Fill buffers
-	stream->samples_pos = stream->samples;
-	int16_t* sampleBuffer = (int16_t*)malloc(channels * sizeof(int16_t*));
+	FillChannelBuffers(stream, channelBuffers.data(), totalSamples, options, g.trimSamples, g.rotateSamples, g.loopPadding);
 
-	for (int i = 2; i < bufferSamples; i++)
-	{
-		if (looped && stream->samples_pos == stream->loop_end)
-			stream->samples_pos = stream->loop_start;
-
-		stream->readSamples(sampleBuffer, 1);
-		for (int x = 0; x < channels; x++)
-			channelBuffers[x][i] = sampleBuffer[x];
-	}
-
-	free(sampleBuffer);
+	QualityReport* report = options != nullptr ? options->report : nullptr;
+	if (report != nullptr)
+		report->begin(channels, sampleRate, totalSamples, g.trimSamples);
 
 	//Calculate coefs
 	for (int i = 0; i < channels; i++) {
-		DSPCorrelateCoefs(channelBuffers[i] + 2, totalSamples, (int16_t*)pAdpcm[i]);
+		CorrelateCoefs(channelBuffers[i] + 2, totalSamples, (int16_t*)pAdpcm[i], options, i);
 		if (progress)
 			progress->update(progress->currentValue + totalSamples);
 	}
 
 	//Encode blocks
+
 	uint8_t* dPtr = (uint8_t*)data->Data();
 	be_int16_t* pyn = (be_int16_t*)adpc->Data();
 	for (int sIndex = 0, bIndex = 1; sIndex < totalSamples; sIndex += 0x3800, bIndex++)
@@ -437,7 +809,7 @@ RSTMHeader* encoder::encode_rstm(PCM16* stream, ProgressTracker* progress, int*
 			}
 
 			//Encode block (include yn in sPtr)
-			EncodeBlock(sPtr, blockSamples, dPtr, (int16_t*)pAdpcm[x]);
+			EncodeBlock(sPtr, blockSamples, dPtr, (int16_t*)pAdpcm[x], report, x, sIndex);
 
 			//Set initial ps
 			if (bIndex == 1)
@@ -491,10 +863,198 @@ RSTMHeader* encoder::encode_rstm(PCM16* stream, ProgressTracker* progress, int*
 
 	//Free memory
 	for (int i = 0; i < channels; i++)
-		free(channelBuffers[i]);
+		FreeChannelBuffer(channelBuffers[i], options);
 
 	if (progress != nullptr)
 		progress->finish();
+}
+
+encoder::Session::Session() : sink(nullptr), type(0), channels(0), sampleRate(0), looped(false), loopStart(0), loopPadding(0),
+	analysisSamples(0), haveCoefs(false), inputFrames(0), blockFill(0), blocksDone(0) {}
+
+void encoder::Session::begin(int type, int channels, int sampleRate, int loopStart, SessionSink* sink, const int16_t* coefs, int analysisSamples) {
+	if (type != FileType::RSTM && type != FileType::CSTM)
+		throw std::invalid_argument("Only RSTM and CSTM can be encoded incrementally");
+	if (channels <= 0 || channels > 255)
+		throw std::invalid_argument("Number of channels must be between 1 and 255");
+	if (sampleRate <= 0 || sampleRate > 65535)
+		throw std::invalid_argument("Sample rate must be between 1 and 65535");
+	if (sink == nullptr)
+		throw std::invalid_argument("No sink given");
+
+	this->sink = sink;
+	this->type = type;
+	this->channels = channels;
+	this->sampleRate = sampleRate;
+	this->looped = loopStart >= 0;
+	this->loopStart = looped ? loopStart : 0;
+	this->loopPadding = looped && loopStart % 0x3800 != 0 ? 0x3800 - loopStart % 0x3800 : 0;
+	this->analysisSamples = analysisSamples > 0 ? analysisSamples : sampleRate * 10;
+
+	haveCoefs = coefs != nullptr;
+	if (haveCoefs)
+		this->coefs.assign(coefs, coefs + 16 * channels);
+	else
+		this->coefs.assign(16 * channels, 0);
+
+	inputFrames = 0;
+	pending.clear();
+	loopTail.clear();
+	blockBuffers.assign(channels, vector<int16_t>(0x3802, 0));
+	blockFill = 0;
+	blocksDone = 0;
+	history.clear();
+	ps.assign(channels, 0);
+	lps.assign(channels, 0);
+	lyn1.assign(channels, 0);
+	lyn2.assign(channels, 0);
+	output.resize(channels * 0x2000);
+}
 
-	return rstm;
+void encoder::Session::push(const int16_t* frames, int count) {
+	if (sink == nullptr)
+		throw std::runtime_error("Session has not begun");
+
+	//Keep the frames that the loop padding will repeat after the end
+	if (loopPadding > 0) {
+		int from = loopStart > inputFrames ? loopStart : inputFrames;
+		int to = loopStart + loopPadding < inputFrames + count ? loopStart + loopPadding : inputFrames + count;
+		if (from < to)
+			loopTail.insert(loopTail.end(), frames + (from - inputFrames) * channels, frames + (to - inputFrames) * channels);
+	}
+
+	inputFrames += count;
+	feed(frames, count);
+}
+
+void encoder::Session::feed(const int16_t* frames, int count) {
+	if (!haveCoefs) {
+		pending.insert(pending.end(), frames, frames + count * channels);
+		if ((int)(pending.size() / channels) >= analysisSamples)
+			analyse();
+		return;
+	}
+
+	while (count > 0) {
+		int n = 0x3800 - blockFill;
+		if (n > count) n = count;
+		for (int x = 0; x < channels; x++) {
+			const int16_t* s = frames + x;
+			int16_t* d = blockBuffers[x].data() + 2 + blockFill;
+			for (int i = 0; i < n; i++)
+				d[i] = s[i * channels];
+		}
+		blockFill += n;
+		frames += n * channels;
+		count -= n;
+
+		if (blockFill == 0x3800)
+			flush_block(0x3800, false);
+	}
+}
+
+void encoder::Session::analyse() {
+	int frames = (int)(pending.size() / channels);
+	vector<int16_t> samples(frames);
+	for (int x = 0; x < channels; x++) {
+		for (int i = 0; i < frames; i++)
+			samples[i] = pending[i * channels + x];
+		dspadpcm::correlate_coefs(samples.data(), frames, coefs.data() + 16 * x);
+	}
+	haveCoefs = true;
+
+	vector<int16_t> held;
+	held.swap(pending);
+	feed(held.data(), frames);
+}
+
+void encoder::Session::flush_block(int samples, bool last) {
+	int size = last ? (samples + 13) / 14 * 8 : 0x2000;
+	int total = (size + 0x1F) & ~0x1F;
+	int loopBlock = (loopStart + loopPadding) / 0x3800;
+
+	for (int x = 0; x < channels; x++) {
+		int16_t* buf = blockBuffers[x].data();
+		uint8_t* out = output.data() + x * total;
+
+		//Block yn values come from the samples before encoding
+		if (!last) {
+			history.push_back(buf[0x3801]);
+			history.push_back(buf[0x3800]);
+		}
+
+		EncodeBlock(buf, samples, out, coefs.data() + 16 * x);
+		memset(out + size, 0, total - size);
+
+		if (blocksDone == 0)
+			ps[x] = out[0];
+		if (looped && blocksDone == loopBlock)
+			lps[x] = out[0];
+		if (looped && blocksDone + 1 == loopBlock) {
+			lyn2[x] = buf[0x3800];
+			lyn1[x] = buf[0x3801];
+		}
+
+		//The encoder's reconstruction of this block's end is the next block's history
+		buf[0] = buf[0x3800];
+		buf[1] = buf[0x3801];
+	}
+
+	sink->data(output.data(), total * channels);
+	blocksDone++;
+	blockFill = 0;
+}
+
+void encoder::Session::finish() {
+	if (sink == nullptr)
+		throw std::runtime_error("Session has not begun");
+	if (inputFrames == 0)
+		throw std::invalid_argument("No samples were pushed");
+	if (looped && loopStart >= inputFrames)
+		throw std::invalid_argument("The loop start is past the end of the input");
+
+	//Align the loop start the way encode() does: continue past the end with the loop's first samples
+	if (loopPadding > 0) {
+		int tailFrames = (int)(loopTail.size() / channels);
+		vector<int16_t> padding(loopPadding * channels);
+		for (int i = 0; i < loopPadding; i++)
+			memcpy(&padding[i * channels], &loopTail[(i % tailFrames) * channels], channels * sizeof(int16_t));
+		feed(padding.data(), loopPadding);
+	}
+	if (!haveCoefs)
+		analyse();
+
+	if (blockFill > 0)
+		flush_block(blockFill, true);
+	else
+		history.resize(history.size() - 2 * channels); //The last full block has no entry
+
+	Layout g = plan_layout(FileType::RSTM, channels, inputFrames, looped ? loopStart : -1);
+	int headerSize = g.payloadOffset;
+
+	vector<uint8_t> header(headerSize);
+	SetRstmHeaders(header.data(), g, sampleRate);
+	RSTMHeader* rstm = (RSTMHeader*)header.data();
+	for (int x = 0; x < channels; x++) {
+		ADPCMInfo* info = rstm->HEADData()->GetChannelInfo(x);
+		for (int i = 0; i < 16; i++)
+			info->_coefs[i] = (uint16_t)coefs[16 * x + i];
+		info->_ps = ps[x];
+		info->_lps = lps[x];
+		info->_lyn1 = lyn1[x];
+		info->_lyn2 = lyn2[x];
+	}
+	be_int16_t* pyn = (be_int16_t*)rstm->ADPCData()->Data();
+	for (size_t i = 0; i < history.size(); i++)
+		*pyn++ = history[i];
+
+	SessionSink* target = sink;
+	sink = nullptr;
+	if (type == FileType::CSTM) {
+		vector<uint8_t> cstm(headerSize);
+		ConvertHeaders(rstm, cstm.data());
+		target->header(cstm.data(), cstm.size());
+	} else {
+		target->header(header.data(), header.size());
+	}
 }
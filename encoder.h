@@ -1,11 +1,16 @@
 #pragma once
 
 #include <cstdint>
+#include <vector>
 #include "pcm16.h"
 #include "cwav.h"
 #include "cstm.h"
 #include "rstm.h"
 #include "progresstracker.h"
+#include "coefcache.h"
+#include "quality.h"
+#include "levels.h"
+#include "channelmatrix.h"
 
 namespace rstmcpp {
 	namespace encoder {
@@ -17,9 +22,199 @@ namespace rstmcpp {
             BFSTM = 3
         };
 
-        char* encode(pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut, int type);
-        CWAVHeader* encode_cwav(pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut);
-        CSTMHeader* encode_cstm(pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut);
-		RSTMHeader* encode_rstm(pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut);
+        // How a loop start that isn't on a 0x3800-sample block boundary is moved onto one.
+        enum LoopAlignment : int {
+            // Move the loop later and repeat its first samples after the end. Plays exactly
+            // like the input, but the stream grows by up to 0x37FF samples.
+            PAD = 0,
+            // Drop up to 0x37FF samples from the start of the input. The loop plays exactly;
+            // playback starts that far into the intro.
+            TRIM = 1,
+            // Move the loop earlier, putting its last samples in front of it in place of the
+            // last intro samples before the loop start. The loop plays exactly, and the stream
+            // is shorter than the input; only the first pass differs, inaudibly if the loop is
+            // seamless, since then the audio before the loop end matches that before its start.
+            ROTATE = 2
+        };
+
+        // Bump whenever a change alters the bytes the encoder produces for the same input.
+        // Build indexes include it in their keys so they never hand back stale output.
+        const uint32_t ENCODER_VERSION = 2;
+
+        // Scratch memory kept between encodes, so a long-running process doesn't reallocate
+        // its channel buffers for every file. Use one per thread.
+        class Workspace {
+        public:
+            int16_t* channel_buffer(int channel, int samples);
+            void* scratch(size_t size);
+
+        private:
+            std::vector<std::vector<int16_t> > channelBuffers;
+            std::vector<uint8_t> scratchBuffer;
+        };
+
+        struct EncodeOptions {
+            // If set, coefficients are looked up here before running dspadpcm::correlate_coefs, and stored after.
+            CoefCache* coefCache;
+            // If set, working buffers come from here instead of malloc.
+            Workspace* workspace;
+            // If set, receives error statistics for every encoded frame.
+            QualityReport* report;
+            // If set, measures peak, RMS and loudness of the encoded channels (after matrix, before
+            // gain) while the channel buffers are filled, leaving out loop padding.
+            LevelMeter* levels;
+            // Linear gain applied to the input before coefficients are calculated (saturating).
+            double gain;
+            // If set, gain is ignored and chosen so the input's loudness becomes targetLoudness
+            // (LUFS), lowered if needed so the peak doesn't clip.
+            bool normalize;
+            double targetLoudness;
+            // If set, the output has matrix->outputs channels mixed from the input's channels
+            // as the samples are read; matrix->inputs must equal the stream's channel count.
+            const ChannelMatrix* matrix;
+            // If positive and under half a channel's length in 14-sample frames, coefficients are
+            // estimated from about this many frames, in short runs spread evenly over the channel,
+            // so analysis time stops growing with the input. With a report, both the estimated
+            // and the full coefficients are tried on the whole channel and their SNRs recorded.
+            int analysisFrames;
+            // Take the loudest run from each part of the channel instead of the middle one.
+            bool analysisByEnergy;
+            // LoopAlignment for looped streams.
+            int loopAlignment;
+
+            EncodeOptions() : coefCache(nullptr), workspace(nullptr), report(nullptr), levels(nullptr),
+                gain(1), normalize(false), targetLoudness(0), matrix(nullptr), analysisFrames(0), analysisByEnergy(false),
+                loopAlignment(LoopAlignment::PAD) {}
+        };
+
+        // Where everything goes in an encoded file. Offsets are from the start of the file and
+        // sizes are in bytes, except for the fields that count samples.
+        struct Layout {
+            int type;
+            int channels;
+
+            bool looped;
+            int loopStart; //On a block boundary
+            int totalSamples; //Per channel, after loop alignment
+            int loopPadding; //Samples LoopAlignment::PAD repeats after the loop end
+            int trimSamples; //Samples LoopAlignment::TRIM cuts from the start
+            int rotateSamples; //Samples LoopAlignment::ROTATE moves the loop back by
+
+            int blocks;
+            int samplesPerBlock;
+            int blockSize;
+            int lastBlockSamples;
+            int lastBlockSize; //Without padding
+            int lastBlockTotal; //Padded to 0x20 bytes
+            int channelDataSize; //One channel's blocks, which CWAV stores in one piece
+
+            int headOffset; //HEAD (RSTM) or INFO (CSTM, CWAV)
+            int headSize;
+            int historyOffset; //ADPC (RSTM) or SEEK (CSTM); both 0 for CWAV
+            int historySize;
+            int dataOffset; //DATA, starting with its 0x20-byte section header
+            int dataSize;
+            int payloadOffset; //First byte of ADPCM data
+            int fileSize;
+        };
+
+        // Lays out a file of samples samples per channel without touching any audio, so
+        // callers can size buffers or estimate memory up front. loopStart < 0 means no loop;
+        // otherwise the loop ends at samples and is aligned as alignment says. Throws
+        // std::invalid_argument for an unsupported type or alignment, or a loop start that
+        // isn't before samples.
+        Layout plan_layout(int type, int channels, int samples, int loopStart = -1, int alignment = LoopAlignment::PAD);
+
+        // The layout encode() uses for this stream. Pass the same options as the encode call;
+        // a channel matrix changes the channel count and loopAlignment the loop.
+        Layout plan_layout(const pcm16::PCM16* stream, int type, const EncodeOptions* options = nullptr);
+
+        // Exact size in bytes of the file encode() would produce for this stream.
+        // Pass the same options as the encode call; a channel matrix changes the size.
+        int get_size(const pcm16::PCM16* stream, int type, const EncodeOptions* options = nullptr);
+
+        // The encoders only read the stream and keep no state between calls, so any number of
+        // threads may encode the same stream at once, as long as each has its own Workspace,
+        // QualityReport and LevelMeter (a CoefCache can be shared).
+
+        // Encodes into dest, which must hold at least get_size(stream, type) bytes.
+        void encode_to_ptr(const pcm16::PCM16* stream, ProgressTracker* progress, int type, void* dest, const EncodeOptions* options = nullptr);
+
+        char* encode(const pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut, int type, const EncodeOptions* options = nullptr);
+        CWAVHeader* encode_cwav(const pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut, const EncodeOptions* options = nullptr);
+        CSTMHeader* encode_cstm(const pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut, const EncodeOptions* options = nullptr);
+		RSTMHeader* encode_rstm(const pcm16::PCM16* stream, ProgressTracker* progress, int* sizeOut, const EncodeOptions* options = nullptr);
+
+        void encode_cwav_to(const pcm16::PCM16* stream, ProgressTracker* progress, void* dest, const EncodeOptions* options = nullptr);
+        void encode_cstm_to(const pcm16::PCM16* stream, ProgressTracker* progress, void* dest, const EncodeOptions* options = nullptr);
+        void encode_rstm_to(const pcm16::PCM16* stream, ProgressTracker* progress, void* dest, const EncodeOptions* options = nullptr);
+
+        // For code that writes DSP-ADPCM blocks itself instead of encoding PCM (see splicer.h).
+        // Size of an unlooped RSTM of totalSamples samples per channel.
+        int get_rstm_size(int channels, int totalSamples);
+        // Lays out that RSTM at dest and fills in its headers. The channel info (coefficients,
+        // ps, history) and the ADPC table are left zeroed and the sample data untouched.
+        void write_rstm_headers(void* dest, int channels, int sampleRate, int totalSamples);
+        // Writes the CSTM equivalent of a complete RSTM to dest, which holds as many bytes.
+        void rstm_to_cstm(RSTMHeader* rstm, void* dest);
+
+        // Receives the output of a Session.
+        class SessionSink {
+        public:
+            virtual ~SessionSink() {}
+            // Encoded sample data, in file order, starting right after the header.
+            virtual void data(const void* bytes, size_t size) = 0;
+            // Called once by finish() with everything that comes before the data.
+            virtual void header(const void* bytes, size_t size) = 0;
+        };
+
+        // Encodes audio that is pushed in as it is generated. Each block goes to the sink as
+        // soon as all channels have filled it; the session keeps only the current block,
+        // the samples after the loop start (for loop alignment) and two history samples per
+        // channel per block. RSTM and CSTM only: CWAV stores each channel in one piece.
+        // Loops are always aligned with LoopAlignment::PAD.
+        //
+        // DSP-ADPCM coefficients are either given to begin(), or calculated from the first
+        // analysisSamples samples of each channel, which are held back until then. If the whole input fits in
+        // the analysis window, the output is identical to encode().
+        class Session {
+        public:
+            Session();
+
+            // loopStart < 0 means no loop; a loop ends where the input does. coefs holds 16
+            // per channel, or is null to calculate them. analysisSamples <= 0 means 10 seconds.
+            void begin(int type, int channels, int sampleRate, int loopStart, SessionSink* sink,
+                const int16_t* coefs = nullptr, int analysisSamples = 0);
+            // Adds count frames of interleaved samples.
+            void push(const int16_t* frames, int count);
+            // Encodes what's left and sends the header.
+            void finish();
+
+        private:
+            void feed(const int16_t* frames, int count);
+            void analyse();
+            void flush_block(int samples, bool last);
+
+            SessionSink* sink;
+            int type;
+            int channels;
+            int sampleRate;
+            bool looped;
+            int loopStart; //In the input
+            int loopPadding;
+            int analysisSamples;
+            bool haveCoefs;
+            int inputFrames;
+
+            std::vector<int16_t> coefs; //16 per channel
+            std::vector<int16_t> pending; //Interleaved frames waiting for coefficients
+            std::vector<int16_t> loopTail; //Interleaved frames from the loop start, to repeat after the end
+            std::vector<std::vector<int16_t> > blockBuffers; //Two history samples, then the block
+            int blockFill;
+            int blocksDone;
+            std::vector<int16_t> history; //ADPC yn1, yn2 for each block and channel
+            std::vector<int> ps, lps, lyn1, lyn2;
+            std::vector<uint8_t> output;
+        };
 	}
 }
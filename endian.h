@@ -1,135 +1,73 @@
 #pragma once
 
-#if defined _WIN32 && !defined __CYGWIN__
-#include <winsock2.h>
-#else
-#include <arpa/inet.h> // for ntohs() etc.
-#endif
+#include <cstddef>
 #include <cstdint>
 
 namespace rstmcpp {
 	namespace endian {
-		int32_t swap32(int32_t num);
-		int16_t swap16(int16_t num);
+		// Byte order of the machine we're compiled for. MSVC only targets little-endian
+		// Windows; GCC and Clang say which it is.
+#if defined __BYTE_ORDER__ && defined __ORDER_BIG_ENDIAN__ && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		constexpr bool HOST_BIG_ENDIAN = true;
+#else
+		constexpr bool HOST_BIG_ENDIAN = false;
+#endif
 
-		class be_int16_t {
-		public:
-			be_int16_t() : be_val_(0) {
-			}
-			// Transparently cast from uint16_t
-			be_int16_t(const int16_t &val) : be_val_(htons(val)) {
-			}
-			// Transparently cast to uint16_t
-			operator int16_t() const {
-				return ntohs(be_val_);
-			}
-		private:
-			int16_t be_val_;
-		};
+		// Written as shifts so compilers turn them into a single bswap/rev instruction
+		constexpr uint16_t byte_swap(uint16_t num) {
+			return (uint16_t)((num >> 8) | (num << 8));
+		}
+		constexpr uint32_t byte_swap(uint32_t num) {
+			return (num >> 24) | ((num >> 8) & 0x0000ff00u) | ((num << 8) & 0x00ff0000u) | (num << 24);
+		}
 
-		class be_uint16_t {
-		public:
-			be_uint16_t() : be_val_(0) {
-			}
-			// Transparently cast from uint16_t
-			be_uint16_t(const uint16_t &val) : be_val_(htons(val)) {
-			}
-			// Transparently cast to uint16_t
-			operator uint16_t() const {
-				return ntohs(be_val_);
-			}
-		private:
-			uint16_t be_val_;
-		};
+		constexpr int16_t swap16(int16_t num) {
+			return (int16_t)byte_swap((uint16_t)num);
+		}
+		constexpr int32_t swap32(int32_t num) {
+			return (int32_t)byte_swap((uint32_t)num);
+		}
 
-		class be_int32_t {
-		public:
-			be_int32_t() : be_val_(0) {
-			}
-			// Transparently cast from uint16_t
-			be_int32_t(const int32_t &val) : be_val_(htonl(val)) {
-			}
-			// Transparently cast to uint16_t
-			operator int32_t() const {
-				return ntohl(be_val_);
-			}
-		private:
-			int32_t be_val_;
-		};
+		template <size_t SIZE> struct unsigned_of_size;
+		template <> struct unsigned_of_size<2> { typedef uint16_t type; };
+		template <> struct unsigned_of_size<4> { typedef uint32_t type; };
 
-		class be_uint32_t {
-		public:
-			be_uint32_t() : be_val_(0) {
-			}
-			// Transparently cast from uint16_t
-			be_uint32_t(const uint32_t &val) : be_val_(htonl(val)) {
-			}
-			// Transparently cast to uint16_t
-			operator uint32_t() const {
-				return ntohl(be_val_);
-			}
-		private:
-			uint32_t be_val_;
-		};
+		// A T stored in a fixed byte order, for use in on-disk structs. Converts transparently
+		// to and from T; when the byte order matches the host's, the conversion is a no-op.
+		template <typename T, bool STORED_BIG>
+		class endian_value {
+			typedef typename unsigned_of_size<sizeof(T)>::type raw_type;
 
-		class le_int16_t {
 		public:
-			le_int16_t() : le_val_(0) {
+			constexpr endian_value() : raw_(0) {
 			}
-			// Transparently cast from uint16_t
-			le_int16_t(const int16_t &val) : le_val_(swap16(htons(val))) {
+			// Transparently cast from T
+			constexpr endian_value(const T &val) : raw_(convert((raw_type)val)) {
 			}
-			// Transparently cast to uint16_t
-			operator int16_t() const {
-				return swap16(ntohs(le_val_));
+			// Transparently cast to T
+			constexpr operator T() const {
+				return (T)convert(raw_);
 			}
-		private:
-			int16_t le_val_;
-		};
 
-		class le_uint16_t {
-		public:
-			le_uint16_t() : le_val_(0) {
-			}
-			// Transparently cast from uint16_t
-			le_uint16_t(const uint16_t &val) : le_val_(swap16(htons(val))) {
-			}
-			// Transparently cast to uint16_t
-			operator uint16_t() const {
-				return swap16(ntohs(le_val_));
-			}
 		private:
-			uint16_t le_val_;
-		};
-
-		class le_int32_t {
-		public:
-			le_int32_t() : le_val_(0) {
+			static constexpr raw_type convert(raw_type val) {
+				return STORED_BIG == HOST_BIG_ENDIAN ? val : byte_swap(val);
 			}
-			// Transparently cast from uint16_t
-			le_int32_t(const int32_t &val) : le_val_(swap32(htonl(val))) {
-			}
-			// Transparently cast to uint16_t
-			operator int32_t() const {
-				return swap32(ntohl(le_val_));
-			}
-		private:
-			int32_t le_val_;
-		};
 
-		class le_uint32_t {
-		public:
-			le_uint32_t() : le_val_(0) {
-			}
-			// Transparently cast from uint16_t
-			le_uint32_t(const uint32_t &val) : le_val_(swap32(htonl(val))) {
-			}
-			// Transparently cast to uint16_t
-			operator uint32_t() const {
-				return swap32(ntohl(le_val_));
-			}
-		private:
-			uint32_t le_val_;
+			raw_type raw_;
 		};
+
+		typedef endian_value<int16_t, true> be_int16_t;
+		typedef endian_value<uint16_t, true> be_uint16_t;
+		typedef endian_value<int32_t, true> be_int32_t;
+		typedef endian_value<uint32_t, true> be_uint32_t;
+
+		typedef endian_value<int16_t, false> le_int16_t;
+		typedef endian_value<uint16_t, false> le_uint16_t;
+		typedef endian_value<int32_t, false> le_int32_t;
+		typedef endian_value<uint32_t, false> le_uint32_t;
+
+		static_assert(sizeof(be_int16_t) == 2 && sizeof(be_uint32_t) == 4, "endian_value must not add padding");
+		static_assert(be_uint16_t(0x1234) == 0x1234 && le_uint32_t(0x12345678u) == 0x12345678u, "endian_value must round-trip");
 	}
 }
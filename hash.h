@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rstmcpp {
+	namespace hash {
+		// Fast non-cryptographic 64-bit hash (XXH64 construction) over the bytes at data.
+		// Used to key on-disk caches; not suitable for anything security-related.
+		uint64_t hash64(const void* data, size_t length, uint64_t seed = 0);
+	}
+}
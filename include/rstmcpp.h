@@ -0,0 +1,167 @@
+#pragma once
+
+/*
+ * rstmcpp library interface.
+ *
+ * Plain C API over the encoder, for embedding in other tools. Inputs are taken
+ * from memory, output is written to a caller-provided buffer, and failures are
+ * reported as status codes - no exceptions cross this boundary.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum rstmcpp_status {
+	RSTMCPP_OK = 0,
+	RSTMCPP_INVALID_ARGUMENT = 1,
+	RSTMCPP_INVALID_INPUT = 2,
+	RSTMCPP_UNSUPPORTED_FORMAT = 3,
+	RSTMCPP_BUFFER_TOO_SMALL = 4,
+	RSTMCPP_OUT_OF_MEMORY = 5,
+	RSTMCPP_INTERNAL_ERROR = 6,
+	RSTMCPP_CANCELLED = 7
+} rstmcpp_status;
+
+/* Values match rstmcpp::encoder::FileType. */
+typedef enum rstmcpp_format {
+	RSTMCPP_FORMAT_BRSTM = 0,
+	RSTMCPP_FORMAT_BCSTM = 1,
+	RSTMCPP_FORMAT_BCWAV = 2
+} rstmcpp_format;
+
+/* Interleaved native-endian 16-bit PCM. Set loop_start to -1 for no loop. */
+typedef struct rstmcpp_pcm {
+	int channels;
+	int sample_rate;
+	const int16_t* samples;
+	int frames;
+	int loop_start;
+	int loop_end;
+} rstmcpp_pcm;
+
+/* A loaded input. Encoding only reads it, so several threads may encode one source at
+ * once; just don't change its loop points while they do. */
+typedef struct rstmcpp_source rstmcpp_source;
+
+rstmcpp_status rstmcpp_source_from_wav(const void* data, size_t size, rstmcpp_source** sourceOut);
+rstmcpp_status rstmcpp_source_from_pcm(const rstmcpp_pcm* pcm, rstmcpp_source** sourceOut);
+void rstmcpp_source_free(rstmcpp_source* source);
+
+/* Overrides the loop points read from the input. loop_start < 0 disables looping; loop_end <= 0 means end of input. */
+rstmcpp_status rstmcpp_source_set_loop(rstmcpp_source* source, int loop_start, int loop_end);
+
+/* Values match rstmcpp::encoder::LoopAlignment: how a loop start that isn't on a
+ * 0x3800-sample block boundary is moved onto one. PAD (the default) repeats the start of
+ * the loop after its end; TRIM cuts up to 0x37FF samples from the start of the input;
+ * ROTATE moves the loop back to the block, putting the loop's last samples in place of the
+ * intro samples before it. TRIM and ROTATE add no samples. */
+typedef enum rstmcpp_loop_alignment {
+	RSTMCPP_ALIGN_PAD = 0,
+	RSTMCPP_ALIGN_TRIM = 1,
+	RSTMCPP_ALIGN_ROTATE = 2
+} rstmcpp_loop_alignment;
+
+rstmcpp_status rstmcpp_source_set_loop_alignment(rstmcpp_source* source, rstmcpp_loop_alignment alignment);
+
+/* Exact number of bytes rstmcpp_encode will write for this source and format. */
+rstmcpp_status rstmcpp_encoded_size(const rstmcpp_source* source, rstmcpp_format format, size_t* sizeOut);
+
+/*
+ * Where everything goes in an encoded file, worked out from the format, channel count,
+ * length and loop points alone, so space can be reserved before any audio is loaded.
+ * Offsets are from the start of the file. The history table is ADPC in BRSTM and SEEK in
+ * BCSTM; BCWAV has none (offset and size 0). total_samples and loop_start are after loop
+ * alignment.
+ */
+typedef struct rstmcpp_layout {
+	int total_samples;
+	int loop_start;
+	int blocks;
+	int last_block_samples;
+	size_t block_size;
+	size_t last_block_size;
+	size_t last_block_total;
+	size_t head_offset;
+	size_t head_size;
+	size_t history_offset;
+	size_t history_size;
+	size_t data_offset;
+	size_t data_size;
+	size_t payload_offset;
+	size_t file_size;
+} rstmcpp_layout;
+
+/* frames is the length of the input, or where the loop ends; loop_start < 0 means no loop. */
+rstmcpp_status rstmcpp_plan_layout(rstmcpp_format format, int channels, int frames, int loop_start,
+	rstmcpp_loop_alignment alignment, rstmcpp_layout* layoutOut);
+
+/* Encodes into dest. Fails with RSTMCPP_BUFFER_TOO_SMALL if dest_size is less than rstmcpp_encoded_size. */
+rstmcpp_status rstmcpp_encode(const rstmcpp_source* source, rstmcpp_format format, void* dest, size_t dest_size);
+
+/*
+ * Incremental encoding: push interleaved PCM as it arrives and receive encoded
+ * blocks through a sink, without holding the whole input in memory. Only BRSTM
+ * and BCSTM are supported (BCWAV stores each channel's data contiguously).
+ *
+ * Block data (everything after the DATA section header) is passed to sink->data
+ * in file order as each block fills. The header - everything up to and including
+ * the DATA section header - is passed to sink->header once, from
+ * rstmcpp_session_finish, because its size depends on the final block count; the
+ * caller places it in front of the data. A sink callback returning nonzero
+ * cancels the session with RSTMCPP_CANCELLED.
+ *
+ * Coefficients come from coefs (16 per channel) if given, otherwise from the
+ * first analysis_samples samples of each channel (0 for 10 seconds), which are
+ * held back until then. If the whole input fits in that window, the output is
+ * identical to rstmcpp_encode. loop_start < 0 means no loop; the loop ends at
+ * the last frame.
+ */
+typedef struct rstmcpp_sink {
+	void* user;
+	int (*data)(void* user, const void* bytes, size_t size);
+	int (*header)(void* user, const void* bytes, size_t size);
+} rstmcpp_sink;
+
+typedef struct rstmcpp_session rstmcpp_session;
+
+rstmcpp_status rstmcpp_session_begin(rstmcpp_format format, int channels, int sample_rate, int loop_start,
+	const int16_t* coefs, int analysis_samples, const rstmcpp_sink* sink, rstmcpp_session** sessionOut);
+rstmcpp_status rstmcpp_session_push(rstmcpp_session* session, const int16_t* samples, int frames);
+rstmcpp_status rstmcpp_session_finish(rstmcpp_session* session);
+void rstmcpp_session_free(rstmcpp_session* session);
+
+/*
+ * Editing encoded files: changes the loop flag, loop points and sample rate of a
+ * BRSTM, BCSTM, BFSTM or BCWAV image in place, without re-encoding. Fields set to -1
+ * (sample_rate: 0) are kept. loop_end is the sample count; it can cut the stream short
+ * but not extend it. The loop history is re-derived from the block holding the loop start.
+ */
+typedef struct rstmcpp_patch_fields {
+	int looped;
+	int loop_start;
+	int loop_end;
+	int sample_rate;
+} rstmcpp_patch_fields;
+
+rstmcpp_status rstmcpp_patch(void* data, size_t size, const rstmcpp_patch_fields* fields);
+
+/*
+ * Replaces frames start to start + frames of a BRSTM, BCSTM or BFSTM image in place with
+ * interleaved samples (one per channel of the image, at its sample rate), re-encoding only
+ * the DSP-ADPCM frames that change with the image's own coefficients. The ADPC/SEEK history and loop history are
+ * updated where the range reaches them. frames_encoded_out may be NULL.
+ */
+rstmcpp_status rstmcpp_reencode(void* data, size_t size, int start, const int16_t* samples, int frames,
+	int channels, int sample_rate, uint64_t* frames_encoded_out);
+
+/* Message describing the last failure on the calling thread, or "" if there was none. */
+const char* rstmcpp_last_error(void);
+const char* rstmcpp_status_string(rstmcpp_status status);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,458 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#if defined _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+#include "inspector.h"
+#include "dspadpcm.h"
+#include "encoder.h"
+#include "mappedfile.h"
+
+using std::string;
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::inspector;
+
+namespace {
+	// Bounds checks for pointers computed from offsets stored in the file
+	struct Bounds {
+		const uint8_t* begin;
+		const uint8_t* end;
+
+		void check(const void* p, size_t length) const {
+			const uint8_t* q = (const uint8_t*)p;
+			if (q < begin || q > end || length > (size_t)(end - q))
+				throw std::runtime_error("Header points outside the file");
+		}
+	};
+
+	void read_rstm(const Bounds& bounds, uint8_t* base, StreamInfo& info) {
+		RSTMHeader* rstm = (RSTMHeader*)base;
+		bounds.check(rstm, sizeof(RSTMHeader));
+		info.declaredSize = rstm->_header._length;
+
+		HEADHeader* head = rstm->HEADData();
+		bounds.check(head, 8 + 3 * sizeof(ruint));
+		StrmDataInfo* part1 = head->Part1();
+		bounds.check(part1, sizeof(StrmDataInfo));
+
+		info.dataInfoOffset = (uint32_t)((uint8_t*)part1 - base);
+		info.encoding = part1->_format._encoding;
+		info.channels = part1->_format._channels;
+		info.sampleRate = part1->_sampleRate;
+		info.looped = part1->_format._looped != 0;
+		info.loopStart = part1->_loopStartSample;
+		info.numSamples = part1->_numSamples;
+		info.numBlocks = part1->_numBlocks;
+		info.blockSize = part1->_blockSize;
+		info.samplesPerBlock = part1->_samplesPerBlock;
+		info.lastBlockSize = part1->_lastBlockSize;
+		info.lastBlockSamples = part1->_lastBlockSamples;
+		info.lastBlockTotal = part1->_lastBlockTotal;
+		info.dataOffset = part1->_dataOffset;
+		info.dataSize = rstm->_dataLength - 0x20;
+		info.historyOffset = rstm->_adpcOffset + 0x10;
+		info.historySize = rstm->_adpcLength - 0x10;
+
+		RuintList* list = head->Part3();
+		bounds.check(list, 4);
+		if ((int)(uint32_t)list->_numEntries < info.channels)
+			throw std::runtime_error("HEAD has fewer channel entries than channels");
+		bounds.check(list, 4 + info.channels * sizeof(ruint));
+
+		uint8_t* headBase = head->_entries.Address();
+		for (int i = 0; i < info.channels; i++) {
+			ruint* r = (ruint*)list->Get(headBase, i);
+			bounds.check(r, sizeof(ruint));
+			ADPCMInfo* a = (ADPCMInfo*)r->Offset(headBase);
+			bounds.check(a, sizeof(ADPCMInfo));
+
+			ChannelInfo c;
+			for (int x = 0; x < 16; x++) c.coefs[x] = (int16_t)(uint16_t)a->_coefs[x];
+			c.ps = a->_ps;
+			c.yn1 = a->_yn1;
+			c.yn2 = a->_yn2;
+			c.lps = a->_lps;
+			c.lyn1 = a->_lyn1;
+			c.lyn2 = a->_lyn2;
+			c.infoOffset = (uint32_t)((uint8_t*)a - base);
+			info.channelInfo.push_back(c);
+		}
+	}
+
+	void read_cstm(const Bounds& bounds, uint8_t* base, StreamInfo& info) {
+		CSTMHeader* cstm = (CSTMHeader*)base;
+		bounds.check(cstm, sizeof(CSTMHeader));
+		if (base[4] != 0xFF || base[5] != 0xFE)
+			throw std::runtime_error("Big-endian files are not supported");
+		info.declaredSize = cstm->_length;
+
+		CSTMINFOHeader* infoHeader = cstm->INFOData();
+		bounds.check(infoHeader, 8 + 3 * sizeof(CSTMReference));
+		uint8_t* infoBase = infoHeader->Address() + 8;
+
+		CSTMDataInfo* dataInfo = (CSTMDataInfo*)(infoBase + infoHeader->_streamInfoRef._dataOffset);
+		bounds.check(dataInfo, sizeof(CSTMDataInfo));
+
+		info.dataInfoOffset = (uint32_t)((uint8_t*)dataInfo - base);
+		info.encoding = dataInfo->_format._encoding;
+		info.channels = dataInfo->_format._channels;
+		info.sampleRate = dataInfo->_sampleRate;
+		info.looped = dataInfo->_format._looped != 0;
+		info.loopStart = dataInfo->_loopStartSample;
+		info.numSamples = dataInfo->_numSamples;
+		info.numBlocks = dataInfo->_numBlocks;
+		info.blockSize = dataInfo->_blockSize;
+		info.samplesPerBlock = dataInfo->_samplesPerBlock;
+		info.lastBlockSize = dataInfo->_lastBlockSize;
+		info.lastBlockSamples = dataInfo->_lastBlockSamples;
+		info.lastBlockTotal = dataInfo->_lastBlockTotal;
+
+		CSTMDATAHeader* data = cstm->DATAData();
+		bounds.check(data, 8);
+		info.dataOffset = cstm->_dataBlockRef._dataOffset + 8 + dataInfo->_sampleDataRef._dataOffset;
+		info.dataSize = (uint32_t)cstm->_dataBlockSize - 8 - dataInfo->_sampleDataRef._dataOffset;
+		info.historyOffset = cstm->_seekBlockRef._dataOffset + 0x10;
+		info.historySize = (uint32_t)cstm->_seekBlockSize - 0x10;
+
+		CSTMReferenceList* table = (CSTMReferenceList*)(infoBase + infoHeader->_channelInfoRefTableRef._dataOffset);
+		bounds.check(table, 4);
+		if (table->_numEntries < info.channels)
+			throw std::runtime_error("INFO has fewer channel entries than channels");
+		bounds.check(table, 4 + info.channels * sizeof(CSTMReference));
+
+		for (int i = 0; i < info.channels; i++) {
+			CSTMReference* channelRef = (CSTMReference*)(table->Address() + table->Entries()[i]._dataOffset);
+			bounds.check(channelRef, sizeof(CSTMReference));
+			CSTMADPCMInfo* a = (CSTMADPCMInfo*)((uint8_t*)channelRef + channelRef->_dataOffset);
+			bounds.check(a, sizeof(CSTMADPCMInfo));
+
+			ChannelInfo c;
+			for (int x = 0; x < 16; x++) c.coefs[x] = (int16_t)(uint16_t)a->_coefs[x];
+			c.ps = a->_ps;
+			c.yn1 = a->_yn1;
+			c.yn2 = a->_yn2;
+			c.lps = a->_lps;
+			c.lyn1 = a->_lyn1;
+			c.lyn2 = a->_lyn2;
+			c.infoOffset = (uint32_t)((uint8_t*)a - base);
+			info.channelInfo.push_back(c);
+		}
+	}
+
+	void read_cwav(const Bounds& bounds, uint8_t* base, StreamInfo& info) {
+		CWAVHeader* cwav = (CWAVHeader*)base;
+		bounds.check(cwav, sizeof(CWAVHeader));
+		info.declaredSize = cwav->_length;
+
+		CWAVINFOHeader* infoHeader = cwav->INFOData();
+		bounds.check(infoHeader, 8 + sizeof(CWAVDataInfo) + 4);
+		CWAVDataInfo* dataInfo = &infoHeader->_dataInfo;
+
+		info.dataInfoOffset = (uint32_t)((uint8_t*)dataInfo - base);
+		info.encoding = dataInfo->_format._encoding;
+		info.channels = dataInfo->_format._channels;
+		info.sampleRate = dataInfo->_sampleRate;
+		info.looped = dataInfo->_format._looped != 0;
+		info.loopStart = dataInfo->_loopStartSample;
+		info.numSamples = dataInfo->_numSamples;
+
+		//No blocks - each channel's samples are stored contiguously
+		info.numBlocks = 1;
+		info.samplesPerBlock = info.lastBlockSamples = info.numSamples;
+		info.blockSize = info.lastBlockSize = info.lastBlockTotal = (info.numSamples + 13) / 14 * 8;
+		info.historyOffset = info.historySize = 0;
+
+		CWAVReferenceList* table = infoHeader->ChannelInfoRefTable();
+		if (table->_numEntries < info.channels)
+			throw std::runtime_error("INFO has fewer channel entries than channels");
+		bounds.check(table, 4 + info.channels * sizeof(CWAVReference));
+
+		uint8_t* dataBase = base + cwav->_dataBlockRef._dataOffset + 8;
+		for (int i = 0; i < info.channels; i++) {
+			CWAVChannelInfo* channel = (CWAVChannelInfo*)(table->Address() + table->Entries()[i]._dataOffset);
+			bounds.check(channel, 2 * sizeof(CWAVReference));
+			CWAVADPCMInfo* a = (CWAVADPCMInfo*)((uint8_t*)channel + channel->_infoRef._dataOffset);
+			bounds.check(a, sizeof(CWAVADPCMInfo));
+
+			if (i == 0) {
+				info.dataOffset = (uint32_t)(dataBase + channel->_samples._dataOffset - base);
+				info.dataSize = (uint32_t)cwav->_dataBlockSize - 8 - channel->_samples._dataOffset;
+			} else if (i == 1) {
+				info.lastBlockTotal = channel->_samples._dataOffset - (info.dataOffset - (uint32_t)(dataBase - base));
+			}
+
+			ChannelInfo c;
+			for (int x = 0; x < 16; x++) c.coefs[x] = (int16_t)(uint16_t)a->_coefs[x];
+			c.ps = a->_ps;
+			c.yn1 = a->_yn1;
+			c.yn2 = a->_yn2;
+			c.lps = a->_lps;
+			c.lyn1 = a->_lyn1;
+			c.lyn2 = a->_lyn2;
+			c.infoOffset = (uint32_t)((uint8_t*)a - base);
+			info.channelInfo.push_back(c);
+		}
+	}
+
+	string json_escape(const char* s) {
+		string out;
+		for (; *s; s++) {
+			unsigned char ch = (unsigned char)*s;
+			if (ch == '"' || ch == '\\') {
+				out += '\\';
+				out += (char)ch;
+			} else if (ch < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", ch);
+				out += buf;
+			} else {
+				out += (char)ch;
+			}
+		}
+		return out;
+	}
+
+	bool has_stream_extension(const string& name) {
+		size_t dot = name.rfind('.');
+		if (dot == string::npos) return false;
+		string ext = name.substr(dot);
+		for (size_t i = 0; i < ext.size(); i++)
+			ext[i] = (char)tolower((unsigned char)ext[i]);
+		return ext == ".brstm" || ext == ".bcstm" || ext == ".bfstm" || ext == ".bcwav";
+	}
+
+	void find_files(const string& directory, vector<string>& out) {
+#if defined _WIN32
+		WIN32_FIND_DATAA entry;
+		HANDLE handle = FindFirstFileA((directory + "\\*").c_str(), &entry);
+		if (handle == INVALID_HANDLE_VALUE) return;
+		do {
+			string name = entry.cFileName;
+			if (name == "." || name == "..") continue;
+			string path = directory + "\\" + name;
+			if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				find_files(path, out);
+			else if (has_stream_extension(name))
+				out.push_back(path);
+		} while (FindNextFileA(handle, &entry));
+		FindClose(handle);
+#else
+		DIR* dir = opendir(directory.c_str());
+		if (dir == NULL) return;
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != NULL) {
+			string name = entry->d_name;
+			if (name == "." || name == "..") continue;
+			string path = directory + "/" + name;
+			struct stat st;
+			if (lstat(path.c_str(), &st) != 0) continue;
+			if (S_ISDIR(st.st_mode))
+				find_files(path, out);
+			else if (S_ISREG(st.st_mode) && has_stream_extension(name))
+				out.push_back(path);
+		}
+		closedir(dir);
+#endif
+	}
+
+	// One JSON line describing path, or an error line
+	string describe(const char* path, bool* ok) {
+		string line;
+		char* buffer = NULL;
+		size_t length = 0;
+		FILE* out = NULL;
+
+		MappedFile file;
+		if (!file.open(path)) {
+			*ok = false;
+			return "{\"path\": \"" + json_escape(path) + "\", \"error\": \"Could not open file\"}\n";
+		}
+
+		try {
+			StreamInfo info = read_info(file.data(), file.size());
+#if defined _WIN32
+			// No open_memstream on Windows; go through a temporary file
+			out = tmpfile();
+			write_json(out, path, file.size(), info);
+			length = ftell(out);
+			rewind(out);
+			line.resize(length);
+			fread(&line[0], 1, length, out);
+			fclose(out);
+#else
+			out = open_memstream(&buffer, &length);
+			write_json(out, path, file.size(), info);
+			fclose(out);
+			line.assign(buffer, length);
+			free(buffer);
+#endif
+			*ok = true;
+		} catch (std::exception& e) {
+			*ok = false;
+			line = "{\"path\": \"" + json_escape(path) + "\", \"error\": \"" + json_escape(e.what()) + "\"}\n";
+		}
+		return line;
+	}
+}
+
+StreamInfo inspector::read_info(const uint8_t* data, size_t size) {
+	if (size < 0x40)
+		throw std::runtime_error("File is too small to be a stream");
+
+	Bounds bounds = { data, data + size };
+	StreamInfo info;
+	uint8_t* base = (uint8_t*)data; //The typed views don't write through these pointers
+
+	if (!memcmp(data, "RSTM", 4)) {
+		info.type = encoder::FileType::RSTM;
+		read_rstm(bounds, base, info);
+	} else if (!memcmp(data, "CSTM", 4)) {
+		info.type = encoder::FileType::CSTM;
+		read_cstm(bounds, base, info);
+	} else if (!memcmp(data, "FSTM", 4)) {
+		info.type = encoder::FileType::BFSTM;
+		read_cstm(bounds, base, info);
+	} else if (!memcmp(data, "CWAV", 4)) {
+		info.type = encoder::FileType::CWAV;
+		read_cwav(bounds, base, info);
+	} else {
+		throw std::runtime_error("Not an RSTM, CSTM, FSTM or CWAV file");
+	}
+
+	if (info.channels <= 0)
+		throw std::runtime_error("Stream has no channels");
+	return info;
+}
+
+void inspector::check_block_fields(const StreamInfo& info) {
+	if (info.samplesPerBlock != BLOCK_SAMPLES || info.blockSize != BLOCK_SIZE)
+		throw std::runtime_error("Stream doesn't use 0x3800-sample blocks");
+	if (info.numSamples == 0 || info.numBlocks != (info.numSamples + BLOCK_SAMPLES - 1) / BLOCK_SAMPLES
+		|| info.lastBlockSamples != info.numSamples - (info.numBlocks - 1) * BLOCK_SAMPLES
+		|| info.lastBlockSize != (info.lastBlockSamples + 13) / 14 * 8)
+		throw std::runtime_error("Block fields don't match the sample count");
+}
+
+size_t inspector::block_offset(const StreamInfo& info, uint32_t block, int channel) {
+	uint32_t stride = block == info.numBlocks - 1 ? info.lastBlockTotal : info.blockSize;
+	return info.dataOffset + (size_t)block * info.blockSize * info.channels + (size_t)channel * stride;
+}
+
+void inspector::block_history(const uint8_t* data, size_t size, const StreamInfo& info, uint32_t block, int channel, int* yn1, int* yn2) {
+	if (block == 0) {
+		*yn1 = info.channelInfo[channel].yn1;
+		*yn2 = info.channelInfo[channel].yn2;
+		return;
+	}
+
+	//ADPC/SEEK has yn1, yn2 for the start of every block after the first
+	size_t entry = info.historyOffset + ((size_t)(block - 1) * info.channels + channel) * 4;
+	if (info.historyOffset == 0 || entry > size || size - entry < 4)
+		throw std::runtime_error("Header points outside the file");
+	const uint8_t* p = data + entry;
+	if (info.type == encoder::FileType::RSTM) {
+		*yn1 = (int16_t)(p[0] << 8 | p[1]);
+		*yn2 = (int16_t)(p[2] << 8 | p[3]);
+	} else {
+		*yn1 = (int16_t)(p[1] << 8 | p[0]);
+		*yn2 = (int16_t)(p[3] << 8 | p[2]);
+	}
+}
+
+void inspector::block_state(const uint8_t* data, size_t size, const StreamInfo& info, uint32_t block, int channel, int* yn1, int* yn2) {
+	if (block == 0) {
+		block_history(data, size, info, 0, channel, yn1, yn2);
+		return;
+	}
+
+	//Decode the block before from its own ADPC/SEEK history, so any error in that has died out
+	block_history(data, size, info, block - 1, channel, yn1, yn2);
+	size_t offset = block_offset(info, block - 1, channel);
+	size_t length = (size_t)(info.samplesPerBlock + 13) / 14 * 8;
+	if (offset > size || length > size - offset)
+		throw std::runtime_error("Header points outside the file");
+
+	const int16_t* coefs = info.channelInfo[channel].coefs;
+	int16_t out[14];
+	for (uint32_t s = 0; s < info.samplesPerBlock; s += 14) {
+		int count = info.samplesPerBlock - s < 14 ? (int)(info.samplesPerBlock - s) : 14;
+		dspadpcm::decode_frame(data + offset + s / 14 * 8, coefs, count, out, yn1, yn2);
+	}
+}
+
+const char* inspector::format_name(int type) {
+	switch (type) {
+		case encoder::FileType::RSTM: return "BRSTM";
+		case encoder::FileType::CSTM: return "BCSTM";
+		case encoder::FileType::CWAV: return "BCWAV";
+		case encoder::FileType::BFSTM: return "BFSTM";
+	}
+	return "unknown";
+}
+
+void inspector::write_json(FILE* file, const char* path, size_t fileSize, const StreamInfo& info) {
+	bool truncated = (uint64_t)info.dataOffset + info.dataSize > fileSize;
+	fprintf(file, "{\"path\": \"%s\", \"format\": \"%s\", \"fileSize\": %lu, \"declaredSize\": %u, "
+		"\"channels\": %d, \"sampleRate\": %u, \"looped\": %s, \"loopStart\": %u, \"numSamples\": %u, "
+		"\"numBlocks\": %u, \"blockSize\": %u, \"samplesPerBlock\": %u, "
+		"\"lastBlockSize\": %u, \"lastBlockSamples\": %u, \"lastBlockTotal\": %u, "
+		"\"dataOffset\": %u, \"dataSize\": %u, \"truncated\": %s}\n",
+		json_escape(path).c_str(), format_name(info.type), (unsigned long)fileSize, info.declaredSize,
+		info.channels, info.sampleRate, info.looped ? "true" : "false", info.loopStart, info.numSamples,
+		info.numBlocks, info.blockSize, info.samplesPerBlock,
+		info.lastBlockSize, info.lastBlockSamples, info.lastBlockTotal,
+		info.dataOffset, info.dataSize, truncated ? "true" : "false");
+}
+
+int inspector::info(int count, char** paths) {
+	int result = 0;
+	for (int i = 0; i < count; i++) {
+		bool ok;
+		fputs(describe(paths[i], &ok).c_str(), stdout);
+		if (!ok) result = 1;
+	}
+	return result;
+}
+
+int inspector::scan(const char* directory, int threads) {
+	vector<string> files;
+	find_files(directory, files);
+	std::sort(files.begin(), files.end());
+
+	if (threads <= 0)
+		threads = std::thread::hardware_concurrency();
+	if (threads <= 0)
+		threads = 1;
+	if (threads > (int)files.size())
+		threads = files.size() > 0 ? (int)files.size() : 1;
+
+	// Workers claim files by index; lines are printed in directory order afterwards
+	vector<string> lines(files.size());
+	std::atomic<size_t> next(0);
+	std::atomic<int> failures(0);
+	vector<std::thread> pool;
+	for (int t = 0; t < threads; t++) {
+		pool.push_back(std::thread([&]() {
+			size_t i;
+			while ((i = next++) < files.size()) {
+				bool ok;
+				lines[i] = describe(files[i].c_str(), &ok);
+				if (!ok) failures++;
+			}
+		}));
+	}
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+
+	for (size_t i = 0; i < lines.size(); i++)
+		fputs(lines[i].c_str(), stdout);
+	return failures > 0 ? 1 : 0;
+}
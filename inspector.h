@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace rstmcpp {
+	namespace inspector {
+		// Per-channel DSP-ADPCM decoder state, in host byte order.
+		struct ChannelInfo {
+			int16_t coefs[16];
+			int16_t ps;
+			int16_t yn1;
+			int16_t yn2;
+			int16_t lps;
+			int16_t lyn1;
+			int16_t lyn2;
+			uint32_t infoOffset; //Where the ADPCMInfo, CSTMADPCMInfo or CWAVADPCMInfo starts
+		};
+
+		// Everything the headers of an RSTM, CSTM, FSTM or CWAV file say about its audio,
+		// independent of the container. Offsets are from the start of the file.
+		struct StreamInfo {
+			int type; //encoder::FileType
+			uint32_t declaredSize; //File length according to the header
+
+			int channels;
+			uint32_t sampleRate;
+			bool looped;
+			uint32_t loopStart;
+			uint32_t numSamples;
+
+			uint32_t numBlocks;
+			uint32_t blockSize;
+			uint32_t samplesPerBlock;
+			uint32_t lastBlockSize;
+			uint32_t lastBlockSamples;
+			uint32_t lastBlockTotal;
+
+			uint32_t dataOffset; //First byte of ADPCM data
+			uint32_t dataSize;
+			uint32_t historyOffset; //ADPC/SEEK table of per-block yn values; 0 if the format has none
+			uint32_t historySize;
+			uint32_t dataInfoOffset; //Where the StrmDataInfo, CSTMDataInfo or CWAVDataInfo starts
+			uint8_t encoding; //2 for DSP-ADPCM
+
+			std::vector<ChannelInfo> channelInfo;
+		};
+
+		// Parses the headers of a file image, reading nothing past them. Every offset taken
+		// from the file is checked against size; malformed input throws std::runtime_error.
+		StreamInfo read_info(const uint8_t* data, size_t size);
+
+		// Block layout of the RSTM, CSTM and FSTM files the encoder writes.
+		const uint32_t BLOCK_SAMPLES = 0x3800;
+		const uint32_t BLOCK_SIZE = 0x2000;
+
+		// Throws std::runtime_error unless an RSTM, CSTM or FSTM from read_info has blocks of
+		// BLOCK_SAMPLES samples in BLOCK_SIZE bytes, and a block count and last block that match
+		// its sample count.
+		void check_block_fields(const StreamInfo& info);
+
+		// Offset of one channel's data in a block of an RSTM, CSTM or FSTM, from read_info.
+		size_t block_offset(const StreamInfo& info, uint32_t block, int channel);
+
+		// Decoder history (yn1, yn2) for the start of a block of an RSTM, CSTM or FSTM: the
+		// channel's initial history for the first block, the ADPC/SEEK entry for the others.
+		void block_history(const uint8_t* data, size_t size, const StreamInfo& info, uint32_t block, int channel, int* yn1, int* yn2);
+
+		// Decoder state (yn1, yn2) at the start of a block of an RSTM, CSTM or FSTM as a continuous
+		// decode reaches it: the block before is decoded from its own ADPC/SEEK history. Unlike
+		// block_history, this is what the encoder left there, not the original samples.
+		void block_state(const uint8_t* data, size_t size, const StreamInfo& info, uint32_t block, int channel, int* yn1, int* yn2);
+
+		const char* format_name(int type);
+
+		// Writes info as a single JSON object followed by a newline.
+		void write_json(FILE* file, const char* path, size_t fileSize, const StreamInfo& info);
+
+		// Prints one JSON line per file. Returns a process exit code.
+		int info(int count, char** paths);
+
+		// Recursively finds stream files under directory and prints one JSON line per file,
+		// reading headers on the given number of threads (0 = one per core).
+		int scan(const char* directory, int threads);
+	}
+}
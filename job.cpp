@@ -0,0 +1,161 @@
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "job.h"
+#include "encoder.h"
+#include "loopfinder.h"
+
+using namespace rstmcpp;
+using namespace rstmcpp::pcm16;
+
+EncodeJob::EncodeJob() {
+	inputFile = NULL;
+	outputFile = NULL;
+	forceLoop = false;
+	forceNoLoop = false;
+	loopStart = 0;
+	loopEnd = 0;
+	autoLoop = false;
+	gainDb = 0;
+	normalize = false;
+	targetLoudness = 0;
+	analysisFrames = 0;
+	analysisByEnergy = false;
+	loopAlignment = encoder::LoopAlignment::PAD;
+}
+
+bool EncodeJob::parse_option(const char* arg) {
+	if (!strcmp(arg, "-lauto")) {
+		autoLoop = true;
+		forceLoop = false;
+		forceNoLoop = false;
+		return true;
+	} else if (arg[0] == '-' && arg[1] == 'l') {
+		forceLoop = true;
+		forceNoLoop = false;
+		autoLoop = false;
+
+		loopStart = 0;
+		const char* ptr = arg + 2;
+		while (*ptr >= '0' && *ptr <= '9') {
+			// Parse digit
+			loopStart = loopStart * 10 + (*ptr - '0');
+			ptr++;
+		}
+		if (*ptr == '-') {
+			// Get loop end
+			loopEnd = 0;
+			ptr++;
+			while (*ptr >= '0' && *ptr <= '9') {
+				// Parse digit
+				loopEnd = loopEnd * 10 + (*ptr - '0');
+				ptr++;
+			}
+		} else {
+			loopEnd = 0;
+		}
+		return true;
+	} else if (!strcmp(arg, "-noloop")) {
+		forceNoLoop = true;
+		forceLoop = false;
+		autoLoop = false;
+		return true;
+	} else if (!strncmp(arg, "-gain", 5) && arg[5] != '\0') {
+		char* end;
+		gainDb = strtod(arg + 5, &end);
+		return *end == '\0';
+	} else if (!strncmp(arg, "-channels", 9) && arg[9] != '\0') {
+		channelMap = arg + 9;
+		return true;
+	} else if (!strcmp(arg, "-downmix")) {
+		channelMap = "stereo";
+		return true;
+	} else if (!strncmp(arg, "-analysis", 9) && arg[9] >= '0' && arg[9] <= '9') {
+		char* end;
+		analysisFrames = (int)strtol(arg + 9, &end, 10);
+		analysisByEnergy = !strcmp(end, "-energy");
+		return *end == '\0' || analysisByEnergy;
+	} else if (!strcmp(arg, "-alignpad")) {
+		loopAlignment = encoder::LoopAlignment::PAD;
+		return true;
+	} else if (!strcmp(arg, "-aligntrim")) {
+		loopAlignment = encoder::LoopAlignment::TRIM;
+		return true;
+	} else if (!strcmp(arg, "-alignrotate")) {
+		loopAlignment = encoder::LoopAlignment::ROTATE;
+		return true;
+	} else if (!strncmp(arg, "-normalize", 10) && arg[10] != '\0') {
+		char* end;
+		targetLoudness = strtod(arg + 10, &end);
+		normalize = true;
+		return *end == '\0';
+	}
+	return false;
+}
+
+void EncodeJob::apply_options(const PCM16* wav, encoder::EncodeOptions* options) {
+	options->gain = pow(10.0, gainDb / 20);
+	options->normalize = normalize;
+	options->targetLoudness = targetLoudness;
+	options->analysisFrames = analysisFrames;
+	options->analysisByEnergy = analysisByEnergy;
+	options->loopAlignment = loopAlignment;
+	if (!channelMap.empty()) {
+		matrix = ChannelMatrix::parse(channelMap.c_str(), wav->channels);
+		options->matrix = &matrix;
+	}
+}
+
+void EncodeJob::apply_loop(PCM16* wav) const {
+	if (forceNoLoop) wav->looping = false;
+	if (forceLoop) {
+		int frames = (int)((wav->samples_end - wav->samples) / wav->channels);
+		int end = loopEnd == 0 ? frames : loopEnd;
+		if (loopStart < 0 || loopStart >= end || end > frames)
+			throw std::invalid_argument("Loop points must satisfy 0 <= start < end <= frame count");
+		wav->looping = true;
+		wav->loop_start = wav->samples + (ptrdiff_t)loopStart * wav->channels;
+		wav->loop_end = wav->samples + (ptrdiff_t)end * wav->channels;
+	}
+	if (autoLoop) {
+		loopfinder::Options options;
+		options.count = 1;
+		std::vector<loopfinder::Candidate> found = loopfinder::find(wav, options);
+		if (found.empty())
+			throw std::runtime_error("Could not find loop points");
+		wav->looping = true;
+		wav->loop_start = wav->samples + (ptrdiff_t)found[0].start * wav->channels;
+		wav->loop_end = wav->samples + (ptrdiff_t)found[0].end * wav->channels;
+	}
+}
+
+int EncodeJob::output_type() const {
+	return type_from_extension(outputFile);
+}
+
+int rstmcpp::type_from_extension(const char* path) {
+	const char* ext = path + strlen(path);
+	while (ext > path && ext[0] != '.') {
+		ext--;
+	}
+
+	if (!strcmp(".brstm", ext)) return encoder::FileType::RSTM;
+	if (!strcmp(".bcstm", ext)) return encoder::FileType::CSTM;
+	if (!strcmp(".bcwav", ext)) return encoder::FileType::CWAV;
+	if (!strcmp(".bfstm", ext)) return encoder::FileType::BFSTM;
+	return -1;
+}
+
+std::vector<std::string> rstmcpp::split_tabs(const std::string& line) {
+	std::vector<std::string> fields;
+	size_t start = 0;
+	for (;;) {
+		size_t tab = line.find('\t', start);
+		fields.push_back(line.substr(start, tab - start));
+		if (tab == std::string::npos) break;
+		start = tab + 1;
+	}
+	return fields;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "pcm16.h"
+#include "encoder.h"
+
+namespace rstmcpp {
+	// Per-file settings for one WAV -> stream conversion, as given on the command line.
+	struct EncodeJob {
+		const char* inputFile;
+		const char* outputFile;
+
+		bool forceLoop;
+		bool forceNoLoop;
+		int loopStart;
+		int loopEnd;
+		bool autoLoop; //Find loop points with loopfinder::find
+
+		double gainDb;
+		bool normalize;
+		double targetLoudness; //LUFS
+		std::string channelMap; //ChannelMatrix::parse syntax, or empty to keep the input's channels
+		int analysisFrames; //In 14-sample ADPCM frames; 0 for full analysis
+		bool analysisByEnergy;
+		int loopAlignment; //encoder::LoopAlignment
+
+		EncodeJob();
+
+		// Handles -l, -l<start>, -l<start-end>, -lauto, -noloop, -gain<dB>, -normalize<LUFS>,
+		// -channels<map>, -downmix, -analysis<frames>, -analysis<frames>-energy, -alignpad,
+		// -aligntrim and -alignrotate.
+		// Returns false if arg isn't one of these.
+		bool parse_option(const char* arg);
+
+		// Applies the loop options above to a freshly loaded WAV. Throws std::invalid_argument
+		// if -l points aren't 0 <= start < end <= frame count, and with -lauto,
+		// std::runtime_error if no loop points can be found.
+		void apply_loop(pcm16::PCM16* wav) const;
+
+		// Copies the gain, normalization, channel map, analysis and loop alignment settings for this WAV into options.
+		// options->matrix points into this job afterwards. Throws std::invalid_argument if the
+		// channel map doesn't fit the WAV.
+		void apply_options(const pcm16::PCM16* wav, encoder::EncodeOptions* options);
+
+		// encoder::FileType for the output file's extension, or -1 if it isn't supported.
+		int output_type() const;
+
+	private:
+		ChannelMatrix matrix;
+	};
+
+	// encoder::FileType for a file name's extension, or -1 if it isn't supported.
+	int type_from_extension(const char* path);
+
+	// Splits a batch list line or daemon request into its tab-separated fields.
+	std::vector<std::string> split_tabs(const std::string& line);
+}
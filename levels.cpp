@@ -0,0 +1,146 @@
+#include <cmath>
+#include <cstdlib>
+#include "levels.h"
+
+using namespace rstmcpp;
+
+static const double PI = 3.14159265358979323846;
+
+LevelMeter::LevelMeter() : gain(1), segmentLength(1) {
+	for (int i = 0; i < 5; i++)
+		shelf[i] = highpass[i] = 0;
+}
+
+void LevelMeter::begin(int channelCount, int sampleRate) {
+	gain = 1;
+	segmentLength = sampleRate / 10;
+	if (segmentLength < 1) segmentLength = 1;
+
+	// BS.1770 pre-filter (high shelf) and RLB weighting (high pass), recomputed for any
+	// sample rate from their analog prototypes
+	double f0 = 1681.974450955533, G = 3.999843853973347, Q = 0.7071752369554196;
+	double K = tan(PI * f0 / sampleRate);
+	double Vh = pow(10.0, G / 20.0);
+	double Vb = pow(Vh, 0.4996667741545416);
+	double a0 = 1.0 + K / Q + K * K;
+	shelf[0] = (Vh + Vb * K / Q + K * K) / a0;
+	shelf[1] = 2.0 * (K * K - Vh) / a0;
+	shelf[2] = (Vh - Vb * K / Q + K * K) / a0;
+	shelf[3] = 2.0 * (K * K - 1.0) / a0;
+	shelf[4] = (1.0 - K / Q + K * K) / a0;
+
+	f0 = 38.13547087602444;
+	Q = 0.5003270373238773;
+	K = tan(PI * f0 / sampleRate);
+	a0 = 1.0 + K / Q + K * K;
+	highpass[0] = 1.0;
+	highpass[1] = -2.0;
+	highpass[2] = 1.0;
+	highpass[3] = 2.0 * (K * K - 1.0) / a0;
+	highpass[4] = (1.0 - K / Q + K * K) / a0;
+
+	Channel empty;
+	empty.peak = 0;
+	empty.sumSquares = 0;
+	empty.samples = 0;
+	for (int i = 0; i < 4; i++) empty.z[i] = 0;
+	channels.assign(channelCount, empty);
+}
+
+void LevelMeter::add(int channel, const int16_t* samples, int count) {
+	Channel& c = channels[channel];
+
+	// Peak and energy: plain loops over contiguous samples that the compiler can vectorize
+	int peak = c.peak;
+	int64_t sumSquares = 0;
+	for (int i = 0; i < count; i++) {
+		int s = samples[i];
+		int a = s < 0 ? -s : s;
+		peak = a > peak ? a : peak;
+		sumSquares += s * s;
+	}
+	c.peak = peak;
+	c.sumSquares += sumSquares;
+
+	// K-weighted energy per 100 ms segment (recursive, so one sample at a time)
+	double z0 = c.z[0], z1 = c.z[1], z2 = c.z[2], z3 = c.z[3];
+	uint64_t position = c.samples;
+	for (int i = 0; i < count; i++, position++) {
+		double x = samples[i] / 32768.0;
+		double y = shelf[0] * x + z0;
+		z0 = shelf[1] * x - shelf[3] * y + z1;
+		z1 = shelf[2] * x - shelf[4] * y;
+		double w = highpass[0] * y + z2;
+		z2 = highpass[1] * y - highpass[3] * w + z3;
+		z3 = highpass[2] * y - highpass[4] * w;
+
+		size_t segment = (size_t)(position / segmentLength);
+		if (segment >= c.segments.size()) c.segments.push_back(0);
+		c.segments[segment] += w * w;
+	}
+	c.z[0] = z0;
+	c.z[1] = z1;
+	c.z[2] = z2;
+	c.z[3] = z3;
+	c.samples = position;
+}
+
+double LevelMeter::peak_db(int channel) const {
+	int p = channels[channel].peak;
+	return p > 0 ? 20 * log10(p / 32768.0) : -INFINITY;
+}
+
+double LevelMeter::rms_db(int channel) const {
+	const Channel& c = channels[channel];
+	if (c.sumSquares == 0) return -INFINITY;
+	return 10 * log10((double)c.sumSquares / c.samples / (32768.0 * 32768.0));
+}
+
+double LevelMeter::loudness() const {
+	// Channel weights: surround channels of a 5.1 stream count 1.41x, the LFE not at all
+	std::vector<double> weights(channels.size(), 1.0);
+	if (channels.size() == 6) {
+		weights[3] = 0;
+		weights[4] = weights[5] = 1.41;
+	}
+
+	// Mean square of each 400 ms block, starting every 100 ms
+	size_t segments = 0;
+	for (size_t c = 0; c < channels.size(); c++)
+		if (channels[c].segments.size() > segments) segments = channels[c].segments.size();
+	size_t perBlock = segments < 4 ? segments : 4;
+
+	std::vector<double> blocks;
+	for (size_t b = 0; b + perBlock <= segments && perBlock > 0; b++) {
+		double z = 0;
+		for (size_t c = 0; c < channels.size(); c++) {
+			const std::vector<double>& s = channels[c].segments;
+			double sum = 0;
+			for (size_t i = b; i < b + perBlock && i < s.size(); i++)
+				sum += s[i];
+			z += weights[c] * sum / ((double)perBlock * segmentLength);
+		}
+		blocks.push_back(z);
+	}
+
+	// Absolute gate at -70 LUFS, then relative gate 10 LU below the remaining mean
+	double threshold = pow(10.0, (-70.0 + 0.691) / 10.0);
+	for (int pass = 0; pass < 2; pass++) {
+		double sum = 0;
+		int count = 0;
+		for (size_t i = 0; i < blocks.size(); i++) {
+			if (blocks[i] > threshold) {
+				sum += blocks[i];
+				count++;
+			}
+		}
+		if (count == 0) return -INFINITY;
+		if (pass == 0) {
+			double relative = sum / count * pow(10.0, -10.0 / 10.0);
+			if (relative > threshold) threshold = relative;
+		} else {
+			return -0.691 + 10 * log10(sum / count);
+		}
+	}
+	return -INFINITY;
+}
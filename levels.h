@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+namespace rstmcpp {
+	// Peak, RMS and integrated loudness (ITU-R BS.1770 K-weighting with absolute and
+	// relative gating) of the channels the encoder reads, measured while it fills its
+	// channel buffers so the input isn't read a second time. Channels are those of the
+	// output, after any channel map.
+	class LevelMeter {
+	public:
+		LevelMeter();
+
+		// Called by the encoder before the first sample.
+		void begin(int channels, int sampleRate);
+
+		// Measures count consecutive samples of one channel, continuing where the last call
+		// for that channel left off.
+		void add(int channel, const int16_t* samples, int count);
+
+		int channel_count() const { return (int)channels.size(); }
+		int peak(int channel) const { return channels[channel].peak; }
+		// Levels in dBFS; -infinity for digital silence.
+		double peak_db(int channel) const;
+		double rms_db(int channel) const;
+		// Integrated loudness of all channels in LUFS; -infinity if every block is gated out.
+		double loudness() const;
+
+		// Linear gain the encoder applied after measuring (1 = none).
+		double gain;
+
+	private:
+		struct Channel {
+			int peak;
+			uint64_t sumSquares;
+			uint64_t samples;
+			double z[4]; //K-weighting filter state
+			std::vector<double> segments; //Sum of K-weighted squares per 100 ms
+		};
+
+		int segmentLength;
+		double shelf[5]; //b0 b1 b2 a1 a2
+		double highpass[5];
+		std::vector<Channel> channels;
+	};
+}
@@ -0,0 +1,287 @@
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include "include/rstmcpp.h"
+#include "encoder.h"
+#include "pcm16.h"
+#include "wavfactory.h"
+#include "patcher.h"
+#include "reencoder.h"
+
+using namespace rstmcpp;
+using namespace rstmcpp::pcm16;
+
+struct rstmcpp_source {
+	PCM16* pcm;
+	encoder::EncodeOptions options;
+};
+
+// Forwards to the C callbacks; a nonzero return unwinds out of the encoder as
+// SessionCancelled
+struct SessionCancelled {};
+
+struct CallbackSink : encoder::SessionSink {
+	rstmcpp_sink sink;
+
+	void data(const void* bytes, size_t size) override {
+		if (sink.data(sink.user, bytes, size) != 0) throw SessionCancelled();
+	}
+	void header(const void* bytes, size_t size) override {
+		if (sink.header(sink.user, bytes, size) != 0) throw SessionCancelled();
+	}
+};
+
+struct rstmcpp_session {
+	CallbackSink sink;
+	encoder::Session session;
+	bool failed;
+};
+
+static thread_local std::string lastError;
+
+static rstmcpp_status fail(rstmcpp_status status, const char* message) {
+	lastError = message;
+	return status;
+}
+
+// Runs f, turning any exception into a status code and a lastError message.
+template <typename F>
+static rstmcpp_status guard(rstmcpp_status onRuntimeError, F f) {
+	try {
+		lastError.clear();
+		return f();
+	} catch (SessionCancelled&) {
+		return fail(RSTMCPP_CANCELLED, "Cancelled by the sink");
+	} catch (std::bad_alloc&) {
+		return fail(RSTMCPP_OUT_OF_MEMORY, "Out of memory");
+	} catch (std::invalid_argument& e) {
+		return fail(RSTMCPP_INVALID_INPUT, e.what());
+	} catch (std::exception& e) {
+		return fail(onRuntimeError, e.what());
+	} catch (...) {
+		return fail(RSTMCPP_INTERNAL_ERROR, "Unknown error");
+	}
+}
+
+static bool valid_format(rstmcpp_format format) {
+	return format == RSTMCPP_FORMAT_BRSTM || format == RSTMCPP_FORMAT_BCSTM || format == RSTMCPP_FORMAT_BCWAV;
+}
+
+rstmcpp_status rstmcpp_source_from_wav(const void* data, size_t size, rstmcpp_source** sourceOut) {
+	if (data == NULL || sourceOut == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "data and sourceOut must not be null");
+
+	return guard(RSTMCPP_INVALID_INPUT, [&]() -> rstmcpp_status {
+		PCM16* pcm = wavfactory::from_buffer(data, size);
+		*sourceOut = new rstmcpp_source();
+		(*sourceOut)->pcm = pcm;
+		return RSTMCPP_OK;
+	});
+}
+
+rstmcpp_status rstmcpp_source_from_pcm(const rstmcpp_pcm* pcm, rstmcpp_source** sourceOut) {
+	if (pcm == NULL || pcm->samples == NULL || sourceOut == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "pcm, pcm->samples and sourceOut must not be null");
+	if (pcm->frames <= 0)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "Frame count must be a positive integer");
+
+	return guard(RSTMCPP_INVALID_INPUT, [&]() -> rstmcpp_status {
+		PCM16* stream = pcm->loop_start < 0
+			? new PCM16(pcm->channels, pcm->sample_rate, (int16_t*)pcm->samples, pcm->frames * pcm->channels)
+			: new PCM16(pcm->channels, pcm->sample_rate, (int16_t*)pcm->samples, pcm->frames * pcm->channels, pcm->loop_start, pcm->loop_end);
+		*sourceOut = new rstmcpp_source();
+		(*sourceOut)->pcm = stream;
+		return RSTMCPP_OK;
+	});
+}
+
+void rstmcpp_source_free(rstmcpp_source* source) {
+	if (source == NULL) return;
+	delete source->pcm;
+	delete source;
+}
+
+rstmcpp_status rstmcpp_source_set_loop(rstmcpp_source* source, int loop_start, int loop_end) {
+	if (source == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "source must not be null");
+
+	PCM16* pcm = source->pcm;
+	int frames = (pcm->samples_end - pcm->samples) / pcm->channels;
+	if (loop_start < 0) {
+		pcm->looping = false;
+		return RSTMCPP_OK;
+	}
+	if (loop_end <= 0) loop_end = frames;
+	if (loop_start >= loop_end || loop_end > frames)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "Loop points must satisfy 0 <= start < end <= frame count");
+
+	pcm->looping = true;
+	pcm->loop_start = pcm->samples + loop_start * pcm->channels;
+	pcm->loop_end = pcm->samples + loop_end * pcm->channels;
+	return RSTMCPP_OK;
+}
+
+rstmcpp_status rstmcpp_source_set_loop_alignment(rstmcpp_source* source, rstmcpp_loop_alignment alignment) {
+	if (source == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "source must not be null");
+	if (alignment != RSTMCPP_ALIGN_PAD && alignment != RSTMCPP_ALIGN_TRIM && alignment != RSTMCPP_ALIGN_ROTATE)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "Unknown loop alignment");
+
+	source->options.loopAlignment = alignment;
+	return RSTMCPP_OK;
+}
+
+rstmcpp_status rstmcpp_encoded_size(const rstmcpp_source* source, rstmcpp_format format, size_t* sizeOut) {
+	if (source == NULL || sizeOut == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "source and sizeOut must not be null");
+	if (!valid_format(format))
+		return fail(RSTMCPP_UNSUPPORTED_FORMAT, "Unsupported output format");
+
+	return guard(RSTMCPP_INTERNAL_ERROR, [&]() -> rstmcpp_status {
+		*sizeOut = (size_t)encoder::get_size(source->pcm, format, &source->options);
+		return RSTMCPP_OK;
+	});
+}
+
+rstmcpp_status rstmcpp_plan_layout(rstmcpp_format format, int channels, int frames, int loop_start,
+	rstmcpp_loop_alignment alignment, rstmcpp_layout* layoutOut) {
+	if (layoutOut == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "layoutOut must not be null");
+	if (!valid_format(format))
+		return fail(RSTMCPP_UNSUPPORTED_FORMAT, "Unsupported output format");
+	if (channels <= 0 || frames <= 0 || loop_start >= frames)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "Channels and frames must be positive, and the loop start before the end");
+
+	return guard(RSTMCPP_INTERNAL_ERROR, [&]() -> rstmcpp_status {
+		encoder::Layout l = encoder::plan_layout(format, channels, frames, loop_start, alignment);
+		layoutOut->total_samples = l.totalSamples;
+		layoutOut->loop_start = l.looped ? l.loopStart : -1;
+		layoutOut->blocks = l.blocks;
+		layoutOut->last_block_samples = l.lastBlockSamples;
+		layoutOut->block_size = (size_t)l.blockSize;
+		layoutOut->last_block_size = (size_t)l.lastBlockSize;
+		layoutOut->last_block_total = (size_t)l.lastBlockTotal;
+		layoutOut->head_offset = (size_t)l.headOffset;
+		layoutOut->head_size = (size_t)l.headSize;
+		layoutOut->history_offset = (size_t)l.historyOffset;
+		layoutOut->history_size = (size_t)l.historySize;
+		layoutOut->data_offset = (size_t)l.dataOffset;
+		layoutOut->data_size = (size_t)l.dataSize;
+		layoutOut->payload_offset = (size_t)l.payloadOffset;
+		layoutOut->file_size = (size_t)l.fileSize;
+		return RSTMCPP_OK;
+	});
+}
+
+rstmcpp_status rstmcpp_encode(const rstmcpp_source* source, rstmcpp_format format, void* dest, size_t dest_size) {
+	if (source == NULL || dest == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "source and dest must not be null");
+	if (!valid_format(format))
+		return fail(RSTMCPP_UNSUPPORTED_FORMAT, "Unsupported output format");
+
+	return guard(RSTMCPP_INTERNAL_ERROR, [&]() -> rstmcpp_status {
+		if ((size_t)encoder::get_size(source->pcm, format, &source->options) > dest_size)
+			return fail(RSTMCPP_BUFFER_TOO_SMALL, "Destination buffer is smaller than rstmcpp_encoded_size");
+
+		encoder::encode_to_ptr(source->pcm, nullptr, format, dest, &source->options);
+		return RSTMCPP_OK;
+	});
+}
+
+rstmcpp_status rstmcpp_session_begin(rstmcpp_format format, int channels, int sample_rate, int loop_start,
+	const int16_t* coefs, int analysis_samples, const rstmcpp_sink* sink, rstmcpp_session** sessionOut) {
+	if (sink == NULL || sink->data == NULL || sink->header == NULL || sessionOut == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "sink, its callbacks and sessionOut must not be null");
+	if (format != RSTMCPP_FORMAT_BRSTM && format != RSTMCPP_FORMAT_BCSTM)
+		return fail(RSTMCPP_UNSUPPORTED_FORMAT, "Only BRSTM and BCSTM can be encoded incrementally");
+
+	return guard(RSTMCPP_INTERNAL_ERROR, [&]() -> rstmcpp_status {
+		std::unique_ptr<rstmcpp_session> session(new rstmcpp_session());
+		session->sink.sink = *sink;
+		session->failed = false;
+		session->session.begin(format, channels, sample_rate, loop_start, &session->sink, coefs, analysis_samples);
+		*sessionOut = session.release();
+		return RSTMCPP_OK;
+	});
+}
+
+rstmcpp_status rstmcpp_session_push(rstmcpp_session* session, const int16_t* samples, int frames) {
+	if (session == NULL || (samples == NULL && frames > 0) || frames < 0)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "session and samples must not be null");
+	if (session->failed)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "Session has already failed");
+
+	rstmcpp_status status = guard(RSTMCPP_INTERNAL_ERROR, [&]() -> rstmcpp_status {
+		session->session.push(samples, frames);
+		return RSTMCPP_OK;
+	});
+	if (status != RSTMCPP_OK) session->failed = true;
+	return status;
+}
+
+rstmcpp_status rstmcpp_session_finish(rstmcpp_session* session) {
+	if (session == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "session must not be null");
+	if (session->failed)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "Session has already failed");
+
+	rstmcpp_status status = guard(RSTMCPP_INTERNAL_ERROR, [&]() -> rstmcpp_status {
+		session->session.finish();
+		return RSTMCPP_OK;
+	});
+	session->failed = true; //Nothing more can be pushed either way
+	return status;
+}
+
+void rstmcpp_session_free(rstmcpp_session* session) {
+	delete session;
+}
+
+rstmcpp_status rstmcpp_patch(void* data, size_t size, const rstmcpp_patch_fields* fields) {
+	if (data == NULL || fields == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "data and fields must not be null");
+
+	return guard(RSTMCPP_INVALID_INPUT, [&]() -> rstmcpp_status {
+		patcher::Patch patch;
+		patch.looped = fields->looped;
+		patch.loopStart = fields->loop_start;
+		patch.loopEnd = fields->loop_end;
+		patch.sampleRate = fields->sample_rate;
+		patcher::apply((uint8_t*)data, size, patch);
+		return RSTMCPP_OK;
+	});
+}
+
+rstmcpp_status rstmcpp_reencode(void* data, size_t size, int start, const int16_t* samples, int frames,
+	int channels, int sample_rate, uint64_t* frames_encoded_out) {
+	if (data == NULL || samples == NULL)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "data and samples must not be null");
+	if (start < 0 || frames <= 0 || channels <= 0 || sample_rate <= 0)
+		return fail(RSTMCPP_INVALID_ARGUMENT, "start must not be negative and frames, channels and sample_rate must be positive");
+
+	return guard(RSTMCPP_INVALID_INPUT, [&]() -> rstmcpp_status {
+		uint64_t encoded = reencoder::reencode((uint8_t*)data, size, (uint32_t)start, samples, (uint32_t)frames, channels, sample_rate);
+		if (frames_encoded_out != NULL)
+			*frames_encoded_out = encoded;
+		return RSTMCPP_OK;
+	});
+}
+
+const char* rstmcpp_last_error(void) {
+	return lastError.c_str();
+}
+
+const char* rstmcpp_status_string(rstmcpp_status status) {
+	switch (status) {
+		case RSTMCPP_OK: return "OK";
+		case RSTMCPP_INVALID_ARGUMENT: return "Invalid argument";
+		case RSTMCPP_INVALID_INPUT: return "Invalid input";
+		case RSTMCPP_UNSUPPORTED_FORMAT: return "Unsupported format";
+		case RSTMCPP_BUFFER_TOO_SMALL: return "Buffer too small";
+		case RSTMCPP_OUT_OF_MEMORY: return "Out of memory";
+		case RSTMCPP_INTERNAL_ERROR: return "Internal error";
+		case RSTMCPP_CANCELLED: return "Cancelled";
+	}
+	return "Unknown status";
+}
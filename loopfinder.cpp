@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <thread>
+#include "loopfinder.h"
+
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::loopfinder;
+using namespace rstmcpp::pcm16;
+
+static const int FRAME_SAMPLES = 14;
+static const int BLOCK_SAMPLES = 0x3800;
+static const int BIN_FRAMES = 16; //Frames per coarse envelope bin, for inputs long enough to need it
+static const int SEARCH_ENDS = 4; //Loop ends tried across Options::endSearch
+static const int SEEDS_PER_END = 8; //Coarse candidates refined for each end
+static const int CHUNK = 4096; //Positions per thread task
+static const double QUIET = 32.768; //-60 dBFS; quieter audio counts as silence
+
+Options::Options() : end(0), endSearch(-1), minLength(0), count(5), threads(0) {}
+
+namespace {
+	struct Seed {
+		int start;
+		int end;
+		double error;
+	};
+
+	template <typename F>
+	void parallel_for(int count, int threads, F body) {
+		if (threads > count) threads = count;
+		if (threads <= 1) {
+			for (int i = 0; i < count; i++) body(i);
+			return;
+		}
+
+		std::atomic<int> next(0);
+		vector<std::thread> pool;
+		for (int t = 0; t < threads; t++) {
+			pool.push_back(std::thread([&]() {
+				int i;
+				while ((i = next++) < count) body(i);
+			}));
+		}
+		for (size_t t = 0; t < pool.size(); t++)
+			pool[t].join();
+	}
+
+	// Relative difference between the length envelope values before a and before b
+	double envelope_error(const float* mean, const float* rms, int a, int b, int length) {
+		double diff = 0, energy = 0;
+		for (int i = 1; i <= length; i++) {
+			double m1 = mean[a - i], m2 = mean[b - i];
+			double r1 = rms[a - i], r2 = rms[b - i];
+			diff += (m1 - m2) * (m1 - m2) + (r1 - r2) * (r1 - r2);
+			energy += m1 * m1 + m2 * m2 + r1 * r1 + r2 * r2;
+		}
+		return diff / (energy + 4 * QUIET * QUIET * length);
+	}
+
+	// Relative difference between the length samples (all channels) before start and before end
+	double sample_error(const PCM16* wav, int start, int end, int length) {
+		const int16_t* a = wav->samples + (ptrdiff_t)start * wav->channels;
+		const int16_t* b = wav->samples + (ptrdiff_t)end * wav->channels;
+		int count = length * wav->channels;
+		int64_t diff = 0, energy = 0;
+		for (int i = 1; i <= count; i++) {
+			int d = a[-i] - b[-i];
+			diff += (int64_t)d * d;
+			energy += (int64_t)a[-i] * a[-i] + (int64_t)b[-i] * b[-i];
+		}
+		return diff / (energy + 2 * QUIET * QUIET * count);
+	}
+
+	bool quiet_before(const PCM16* wav, int end, int length) {
+		const int16_t* p = wav->samples + (ptrdiff_t)end * wav->channels;
+		int count = length * wav->channels;
+		int64_t energy = 0;
+		for (int i = 1; i <= count; i++)
+			energy += p[-i] * p[-i];
+		return energy < QUIET * QUIET * count;
+	}
+
+	double alignment_weight(int start) {
+		if (start % BLOCK_SAMPLES == 0) return 1 / 1.2;
+		if (start % FRAME_SAMPLES == 0) return 1 / 1.1;
+		return 1;
+	}
+}
+
+vector<Candidate> loopfinder::find(const PCM16* wav, const Options& options) {
+	vector<Candidate> results;
+	int channels = wav->channels;
+	int totalSamples = (int)((wav->samples_end - wav->samples) / channels);
+
+	int endLimit = options.end > 0 && options.end < totalSamples ? options.end : totalSamples;
+	int minLength = options.minLength > 0 ? options.minLength : totalSamples / 4;
+	int endSearch = options.endSearch >= 0 ? options.endSearch : std::min(wav->sampleRate * 8, endLimit / 4);
+	int threads = options.threads > 0 ? options.threads : (int)std::thread::hardware_concurrency();
+	if (threads <= 0) threads = 1;
+
+	// Context compared at each resolution: 2 s of envelope bins, 0.5 s of frames, 50 ms of
+	// samples. Windows are cut short near the start of the input, down to a quarter.
+	int sampleLen = std::max(64, wav->sampleRate / 20);
+	int minStart = sampleLen / 4;
+	int frames = endLimit / FRAME_SAMPLES;
+	if (minLength < 1 || endLimit - minLength < minStart || frames < 8)
+		return results;
+
+	int binFrames = frames / BIN_FRAMES >= 256 ? BIN_FRAMES : 1;
+	int binSamples = binFrames * FRAME_SAMPLES;
+	int bins = frames / binFrames;
+	int frameLen = std::max(4, wav->sampleRate / 2 / FRAME_SAMPLES);
+	int binLen = std::max(4, wav->sampleRate * 2 / binSamples);
+
+	// Mean of the mixed-down input and RMS over all channels, per frame, then per bin. The
+	// RMS sums each channel's own energy, so channels in opposite phase don't cancel out.
+	vector<float> frameMean(frames), frameRms(frames);
+	parallel_for((frames + CHUNK - 1) / CHUNK, threads, [&](int task) {
+		int last = std::min(frames, (task + 1) * CHUNK);
+		for (int f = task * CHUNK; f < last; f++) {
+			const int16_t* p = wav->samples + (ptrdiff_t)f * FRAME_SAMPLES * channels;
+			int64_t sum = 0, squares = 0;
+			for (int i = 0; i < FRAME_SAMPLES * channels; i++) {
+				sum += p[i];
+				squares += p[i] * p[i];
+			}
+			frameMean[f] = (float)((double)sum / (FRAME_SAMPLES * channels));
+			frameRms[f] = (float)sqrt((double)squares / (FRAME_SAMPLES * channels));
+		}
+	});
+
+	vector<float> binMean, binRms;
+	if (binFrames == 1) {
+		binMean = frameMean;
+		binRms = frameRms;
+	} else {
+		binMean.resize(bins);
+		binRms.resize(bins);
+		for (int b = 0; b < bins; b++) {
+			double sum = 0, squares = 0;
+			for (int f = b * binFrames; f < (b + 1) * binFrames; f++) {
+				sum += frameMean[f];
+				squares += (double)frameRms[f] * frameRms[f];
+			}
+			binMean[b] = (float)(sum / binFrames);
+			binRms[b] = (float)sqrt(squares / binFrames);
+		}
+	}
+
+	// Loop ends spread over the search range, leaving out quiet ones so a fade-out or
+	// trailing silence doesn't count as a seamless match for any other silence
+	vector<int> ends;
+	for (int i = 0; i < SEARCH_ENDS; i++) {
+		int end = endLimit - (int)((int64_t)endSearch * i / (SEARCH_ENDS - 1));
+		if (end - minLength < minStart || end / binSamples < 2) continue;
+		if (std::find(ends.begin(), ends.end(), end) != ends.end()) continue;
+		if (quiet_before(wav, end, std::min(sampleLen, end))) continue;
+		ends.push_back(end);
+	}
+	if (ends.empty()) ends.push_back(endLimit);
+
+	// Coarse pass: every bin as a start, for each end
+	int endCount = (int)ends.size();
+	vector<vector<float> > coarse(endCount, vector<float>(bins, 2.0f));
+	int chunks = (bins + CHUNK - 1) / CHUNK;
+	parallel_for(endCount * chunks, threads, [&](int task) {
+		int e = task / chunks;
+		int endBin = ends[e] / binSamples;
+		int offset = ends[e] - endBin * binSamples;
+		int lastBin = std::min((task % chunks + 1) * CHUNK, (ends[e] - minLength - offset) / binSamples + 1);
+		for (int b = std::max(task % chunks * CHUNK, std::max(1, binLen / 4)); b < lastBin; b++) {
+			int length = std::min(binLen, std::min(b, endBin));
+			coarse[e][b] = (float)envelope_error(binMean.data(), binRms.data(), b, endBin, length);
+		}
+	});
+
+	// Keep the best local minima of each end, at least 4 bins apart
+	vector<Seed> seeds;
+	for (int e = 0; e < endCount; e++) {
+		const vector<float>& err = coarse[e];
+		vector<int> minima;
+		for (int b = 0; b < bins; b++) {
+			if (err[b] >= 2.0f) continue;
+			bool minimum = true;
+			for (int n = std::max(0, b - 2); n <= std::min(bins - 1, b + 2) && minimum; n++)
+				minimum = n == b || err[n] > err[b] || (err[n] == err[b] && n > b);
+			if (minimum) minima.push_back(b);
+		}
+		std::sort(minima.begin(), minima.end(), [&err](int x, int y) { return err[x] < err[y] || (err[x] == err[y] && x < y); });
+
+		int endBin = ends[e] / binSamples;
+		int offset = ends[e] - endBin * binSamples;
+		int kept = 0;
+		for (size_t i = 0; i < minima.size() && kept < SEEDS_PER_END; i++) {
+			bool close = false;
+			for (int k = 0; k < kept; k++)
+				close = close || std::abs(seeds[seeds.size() - 1 - k].start - (minima[i] * binSamples + offset)) < 4 * binSamples;
+			if (close) continue;
+			Seed seed = { minima[i] * binSamples + offset, ends[e], err[minima[i]] };
+			seeds.push_back(seed);
+			kept++;
+		}
+	}
+
+	// Refine each seed to a frame, then to a sample
+	parallel_for((int)seeds.size(), threads, [&](int i) {
+		Seed& seed = seeds[i];
+		int endFrame = seed.end / FRAME_SAMPLES;
+		int offset = seed.end - endFrame * FRAME_SAMPLES;
+		int guess = (seed.start - offset) / FRAME_SAMPLES;
+		int lastFrame = (seed.end - minLength - offset) / FRAME_SAMPLES;
+		int bestFrame = -1;
+		double best = 0;
+		for (int f = std::max(1, guess - 2 * binFrames); f <= std::min(lastFrame, guess + 2 * binFrames); f++) {
+			int length = std::min(frameLen, std::min(f, endFrame));
+			double err = envelope_error(frameMean.data(), frameRms.data(), f, endFrame, length);
+			if (bestFrame < 0 || err < best) {
+				bestFrame = f;
+				best = err;
+			}
+		}
+		if (bestFrame >= 0) seed.start = bestFrame * FRAME_SAMPLES + offset;
+
+		seed.error = 2;
+		int center = seed.start;
+		for (int s = std::max(minStart, center - FRAME_SAMPLES); s <= std::min(seed.end - minLength, center + FRAME_SAMPLES); s++) {
+			double err = sample_error(wav, s, seed.end, std::min(sampleLen, s));
+			if (err < seed.error) {
+				seed.start = s;
+				seed.error = err;
+			}
+		}
+	});
+
+	// Add each candidate moved onto the frame and block boundaries either side of its start
+	vector<Candidate> candidates;
+	for (size_t i = 0; i < seeds.size(); i++) {
+		if (seeds[i].error >= 2) continue;
+		Candidate c = { seeds[i].start, seeds[i].end, seeds[i].error };
+		candidates.push_back(c);
+		const int alignments[] = { FRAME_SAMPLES, BLOCK_SAMPLES };
+		for (int a = 0; a < 2; a++) {
+			int shift = c.start % alignments[a];
+			if (shift == 0) continue;
+			Candidate earlier = { c.start - shift, c.end - shift, 2 };
+			Candidate later = { earlier.start + alignments[a], earlier.end + alignments[a], 2 };
+			if (earlier.start >= minStart) candidates.push_back(earlier);
+			if (later.end <= endLimit) candidates.push_back(later);
+		}
+	}
+	parallel_for((int)candidates.size(), threads, [&](int i) {
+		Candidate& c = candidates[i];
+		if (c.error >= 2)
+			c.error = sample_error(wav, c.start, c.end, std::min(sampleLen, c.start));
+	});
+
+	std::sort(candidates.begin(), candidates.end(), [](const Candidate& x, const Candidate& y) -> bool {
+		double sx = x.error * alignment_weight(x.start), sy = y.error * alignment_weight(y.start);
+		if (sx != sy) return sx < sy;
+		if (x.end - x.start != y.end - y.start) return x.end - x.start > y.end - y.start;
+		return x.start < y.start;
+	});
+
+	// Report distinct loops only: drop any within a block of a better one
+	for (size_t i = 0; i < candidates.size() && (int)results.size() < options.count; i++) {
+		bool duplicate = false;
+		for (size_t j = 0; j < results.size() && !duplicate; j++)
+			duplicate = std::abs(results[j].start - candidates[i].start) < BLOCK_SAMPLES && std::abs(results[j].end - candidates[i].end) < BLOCK_SAMPLES;
+		if (!duplicate) results.push_back(candidates[i]);
+	}
+	return results;
+}
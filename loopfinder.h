@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "pcm16.h"
+
+namespace rstmcpp {
+	namespace loopfinder {
+		struct Options {
+			int end; //Latest loop end to consider, in samples; 0 for the end of the input
+			int endSearch; //How far before end the loop may end instead; -1 for up to 8 seconds
+			int minLength; //Shortest loop, in samples; 0 for a quarter of the input
+			int count; //Candidates to return
+			int threads; //0 = one per core
+
+			Options();
+		};
+
+		struct Candidate {
+			int start;
+			int end;
+			// Energy of the difference between the audio leading up to the loop end and the
+			// audio leading up to the loop start, relative to their combined energy, over all
+			// channels: 0 for a seamless loop, around 1 for unrelated audio.
+			double error;
+
+			bool frame_aligned() const { return start % 14 == 0; }
+			bool block_aligned() const { return start % 0x3800 == 0; }
+		};
+
+		// Searches wav for loop points where playback can jump from end back to start
+		// without an audible seam. Candidate starts are found on a coarse envelope (the mean
+		// of the mixed-down input and the RMS of all channels), then refined at frame and
+		// sample resolution on every channel, so the cost stays a small fraction of encoding
+		// even for long inputs; each stage is spread over the given number of threads.
+		//
+		// Each candidate is also tried shifted (start and end together) onto the nearest
+		// 14-sample frame and 0x3800-sample block boundaries. Only a block-aligned start is
+		// encoded without padding, trimming or rotation (see encoder::LoopAlignment); a
+		// frame-aligned one keeps the loop start on an ADPCM frame. Results are sorted best
+		// first, where an aligned candidate wins over an unaligned one unless its error is
+		// more than 10% (frame) or 20% (block) higher. Loops of equal error are ordered
+		// longest first. Returns an empty vector if the input is too short to search.
+		std::vector<Candidate> find(const pcm16::PCM16* wav, const Options& options);
+	}
+}
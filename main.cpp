@@ -1,12 +1,30 @@
 #include <iostream>
-#include <cstring>
 #include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 #include "pcm16.h"
 #include "wavfactory.h"
 #include "encoder.h"
+#include "job.h"
+#include "daemon.h"
+#include "decoder.h"
+#include "inspector.h"
+#include "buildindex.h"
+#include "batch.h"
+#include "bench.h"
+#include "loopfinder.h"
+#include "patcher.h"
+#include "reencoder.h"
+#include "remux.h"
+#include "splicer.h"
 
 using std::cerr;
 using std::endl;
+using std::string;
 using namespace rstmcpp;
 using namespace rstmcpp::pcm16;
 
@@ -32,10 +50,256 @@ int usage() {
 	<< "- l               Loop from start of file until end of file" << endl
 	<< "- l<start>        Loop from sample <start> until end of file" << endl
 	<< "- l<start - end>  Loop from sample <start> until sample <end>" << endl
-	<< "- noloop          Do not loop(ignore smpl chunk in WAV file if one exists)" << endl;
+	<< "- lauto           Loop at the most seamless loop points found in the audio" << endl
+	<< "- noloop          Do not loop(ignore smpl chunk in WAV file if one exists)" << endl
+	<< "- alignpad        If the loop start isn't on a 0x3800-sample block, repeat the start of the" << endl
+	<< "                  loop after its end so it is (default)" << endl
+	<< "- aligntrim       ... or cut up to 0x37FF samples from the start of the file instead" << endl
+	<< "- alignrotate     ... or move the loop back to the block, putting the end of the loop in" << endl
+	<< "                  place of the intro samples before it; inaudible for seamless loops" << endl
+	<< "- gain<dB>        Amplify (or attenuate, e.g. -gain-3) before encoding" << endl
+	<< "- normalize<LUFS> Adjust gain so the integrated loudness becomes <LUFS> (e.g. -normalize-16)," << endl
+	<< "                  but no higher than the peak allows" << endl
+	<< "- channels<map>   Remix channels: comma-separated outputs, each a +-separated list of" << endl
+	<< "                  input channels (from 0) with optional *weight, e.g. -channels1,0 or" << endl
+	<< "                  -channels0+2*0.707+4*0.707,1+2*0.707+5*0.707" << endl
+	<< "- downmix         Standard stereo downmix of a mono, stereo or 5.1 input" << endl
+	<< "- analysis<n>     Estimate DSP coefficients from about <n> frames (14 samples each) spread" << endl
+	<< "                  over each channel instead of all of them; faster for long inputs." << endl
+	<< "                  -analysis<n>-energy prefers the loudest parts. With -stats, the SNR" << endl
+	<< "                  lost against full analysis is reported" << endl
+	<< endl
+	<< "Other options: " << endl
+	<< "- cache <dir>     Reuse DSP coefficients from, and save them to, a cache directory" << endl
+	<< "- stats <file>    Write encoding error statistics (SNR, peak error, clipping)" << endl
+	<< "                  and output channel levels (peak, RMS, loudness) as JSON" << endl
+	<< "- index <dir>     Skip encoding if this input and these options were already converted;" << endl
+	<< "                  restore the output from <dir> if it was deleted or changed." << endl
+	<< "                  With -stats the input is always encoded, so the statistics get written" << endl
+	<< endl
+	<< "Splitting one input into several outputs (reads and analyses the input once):" << endl
+	<< "rstmcpp [options] <inputfile> -split <map> <outputfile> [-split <map> <outputfile>]..." << endl
+	<< endl
+	<< "Batch conversion:" << endl
+	<< "rstmcpp -batch <listfile> [-workers <n>] [-cache <dir>]" << endl
+	<< "Each line of listfile is [options] <inputfile> <outputfile>, separated by tabs." << endl
+	<< endl
+	<< "Encode server (Unix only):" << endl
+	<< "rstmcpp -daemon <socket> [-workers <n>] [-cache <dir>]" << endl
+	<< "rstmcpp -client <socket> [options] <inputfile> <outputfile>" << endl
+	<< "rstmcpp -client <socket> -shutdown" << endl
+	<< "Files may be given as shm:<name> to use POSIX shared memory instead." << endl
+	<< endl
+	<< "Inspecting files (prints one JSON object per line):" << endl
+	<< "rstmcpp -info <file>..." << endl
+	<< "rstmcpp -scan <dir> [-threads <n>]" << endl
+	<< endl
+	<< "Changing loop points or sample rate of encoded files in place, without re-encoding:" << endl
+	<< "rstmcpp -patch [-loop <start>-<end> | -loopstart <n> | -loopend <n> | -noloop] [-rate <hz>] <file>..." << endl
+	<< endl
+	<< "Joining or cutting RSTM/CSTM/FSTM files at block boundaries (0x3800 samples), copying the blocks:" << endl
+	<< "rstmcpp -splice [-loopstart <n>] <outputfile> ([-range <start>-[<end>]] <inputfile>)..." << endl
+	<< endl
+	<< "Extracting or merging channels of RSTM/CSTM/FSTM files without re-encoding:" << endl
+	<< "rstmcpp -remux <outputfile> ([-channels <n>[,<n>...]] <inputfile>)..." << endl
+	<< endl
+	<< "Decoding an RSTM/CSTM/FSTM/CWAV file to WAV, a block at a time:" << endl
+	<< "rstmcpp -decode <inputfile> <outputfile.wav>" << endl
+	<< endl
+	<< "Re-encoding part of an RSTM/CSTM/FSTM file in place with its own coefficients:" << endl
+	<< "rstmcpp -reencode [-at <sample>] <file> <replacement.wav>" << endl
+	<< endl
+	<< "Finding loop points (prints the best candidates as JSON, one per line):" << endl
+	<< "rstmcpp -findloop <inputfile> [-count <n>] [-minlength <samples>] [-end <sample>]" << endl
+	<< "        [-endsearch <samples>] [-threads <n>]" << endl
+	<< endl
+	<< "Benchmark (converts a built-in synthetic corpus to every format):" << endl
+	<< "rstmcpp -bench <results.json> [-baseline <results.json>] [-threshold <percent>]" << endl
+	<< "        [-repeat <n>] [-only <case>] [-concurrent <threads>]" << endl
+	<< "Fails if an output differs from the baseline's, or a case got slower by more" << endl
+	<< "than the threshold (default 10%). -concurrent also encodes each input on several" << endl
+	<< "threads at once and fails if any output differs from a single-threaded encode." << endl
+	<< "bench-reference.json has the current outputs' hashes; compare against it with" << endl
+	<< "-threshold 100 on other machines." << endl;
 	return 1;
 }
 
+struct SplitTarget {
+	const char* channelMap;
+	const char* outputFile;
+};
+
+// Encodes one split target; returns an error message, or an empty string on success.
+// job is a copy, since the channel map differs per target.
+string encode_split(EncodeJob job, const PCM16* wav, const SplitTarget& target, CoefCache* cache, bool showProgress) {
+	try {
+		job.channelMap = target.channelMap;
+		encoder::EncodeOptions options;
+		options.coefCache = cache;
+		job.apply_options(wav, &options);
+
+		ProgressTracker progress;
+		int size;
+		char* output = encoder::encode(wav, showProgress ? &progress : nullptr, &size, type_from_extension(target.outputFile), &options);
+
+		FILE* outFile = fopen(target.outputFile, "wb");
+		if (outFile == NULL) {
+			free(output);
+			return string("Could not open file for writing: ") + target.outputFile;
+		}
+		bool ok = fwrite(output, 1, size, outFile) == (size_t)size;
+		ok = (fclose(outFile) == 0) && ok;
+		free(output);
+		if (!ok) return string("Could not write file: ") + target.outputFile;
+	} catch (std::exception& e) {
+		return e.what();
+	}
+	return string();
+}
+
+// Groups targets that have an output channel in common (the same weights over the input
+// channels). A group is encoded one target after another, so the first target's analysis of a
+// shared channel is in the coefficient cache before the next one looks for it.
+std::vector<std::vector<size_t> > group_targets(const std::vector<SplitTarget>& targets, int inputs) {
+	std::vector<size_t> parent(targets.size());
+	for (size_t i = 0; i < targets.size(); i++)
+		parent[i] = i;
+	auto root = [&parent](size_t i) {
+		while (parent[i] != i) i = parent[i] = parent[parent[i]];
+		return i;
+	};
+
+	std::map<std::vector<float>, size_t> owners;
+	for (size_t i = 0; i < targets.size(); i++) {
+		ChannelMatrix matrix;
+		try {
+			matrix = ChannelMatrix::parse(targets[i].channelMap, inputs);
+		} catch (std::exception&) {
+			continue; //Reported when the target is encoded
+		}
+		for (int x = 0; x < matrix.outputs; x++) {
+			std::vector<float> row(matrix.weights.begin() + x * inputs, matrix.weights.begin() + (x + 1) * inputs);
+			auto found = owners.insert(std::make_pair(row, i));
+			if (!found.second)
+				parent[root(i)] = root(found.first->second);
+		}
+	}
+
+	std::vector<std::vector<size_t> > groups;
+	std::map<size_t, size_t> groupOf;
+	for (size_t i = 0; i < targets.size(); i++) {
+		auto found = groupOf.insert(std::make_pair(root(i), groups.size()));
+		if (found.second) groups.push_back(std::vector<size_t>());
+		groups[found.first->second].push_back(i);
+	}
+	return groups;
+}
+
+// Encodes one WAV to several outputs, each with its own channel map. Groups of outputs that
+// share no channels run in parallel when there are cores to spare; channels that come out
+// identical in more than one output are analysed once (see group_targets).
+int split_outputs(EncodeJob& job, const std::vector<SplitTarget>& targets, const char* cacheDir) {
+	for (size_t i = 0; i < targets.size(); i++) {
+		if (type_from_extension(targets[i].outputFile) < 0) {
+			cerr << "Unsupported output format: " << targets[i].outputFile << endl;
+			return 1;
+		}
+	}
+
+	FILE* inFile = fopen(job.inputFile, "rb");
+	if (inFile == NULL) {
+		cerr << "Could not open file: " << job.inputFile << endl;
+		return 1;
+	}
+
+	PCM16* wav = NULL;
+	CoefCache cache(cacheDir);
+	try {
+		wav = wavfactory::from_file(inFile);
+		job.apply_loop(wav);
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+		delete wav;
+		wav = NULL;
+	}
+	fclose(inFile);
+	if (wav == NULL) return 1;
+
+	std::vector<string> errors(targets.size());
+	std::vector<std::vector<size_t> > groups = group_targets(targets, wav->channels);
+	unsigned cores = std::thread::hardware_concurrency();
+	if (groups.size() > 1 && cores > 1) {
+		// The encoder only reads the WAV, so every thread can share it
+		std::vector<std::thread> threads;
+		for (size_t next = 0; next < groups.size(); ) {
+			for (unsigned t = 0; t < cores && next < groups.size(); t++, next++) {
+				threads.push_back(std::thread([&job, wav, &targets, &groups, &cache, &errors, next]() {
+					for (size_t i : groups[next])
+						errors[i] = encode_split(job, wav, targets[i], &cache, false);
+				}));
+			}
+			for (size_t t = 0; t < threads.size(); t++)
+				threads[t].join();
+			threads.clear();
+		}
+	} else {
+		for (size_t i = 0; i < targets.size(); i++)
+			errors[i] = encode_split(job, wav, targets[i], &cache, true);
+	}
+
+	int result = 0;
+	for (size_t i = 0; i < targets.size(); i++) {
+		if (!errors[i].empty()) {
+			cerr << targets[i].outputFile << ": " << errors[i] << endl;
+			result = 1;
+		}
+	}
+
+	delete wav;
+	return result;
+}
+
+// Prints the best loop points of a WAV file; -findloop's arguments follow the input file.
+int find_loops(const char* inputFile, int argc, char** argv) {
+	loopfinder::Options options;
+	for (int i = 0; i < argc; i += 2) {
+		if (i + 1 >= argc) return usage();
+		if (!strcmp(argv[i], "-count")) options.count = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-minlength")) options.minLength = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-end")) options.end = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-endsearch")) options.endSearch = atoi(argv[i + 1]);
+		else if (!strcmp(argv[i], "-threads")) options.threads = atoi(argv[i + 1]);
+		else return usage();
+	}
+
+	FILE* inFile = fopen(inputFile, "rb");
+	if (inFile == NULL) {
+		cerr << "Could not open file: " << inputFile << endl;
+		return 1;
+	}
+	PCM16* wav = NULL;
+	try {
+		wav = wavfactory::from_file(inFile);
+	} catch (std::exception& e) {
+		cerr << e.what() << endl;
+	}
+	fclose(inFile);
+	if (wav == NULL) return 1;
+
+	std::vector<loopfinder::Candidate> found = loopfinder::find(wav, options);
+	delete wav;
+	for (size_t i = 0; i < found.size(); i++) {
+		const loopfinder::Candidate& c = found[i];
+		printf("{\"start\":%d,\"end\":%d,\"error\":%.6g,\"aligned\":\"%s\"}\n", c.start, c.end, c.error,
+			c.block_aligned() ? "block" : c.frame_aligned() ? "frame" : "none");
+	}
+	if (found.empty()) {
+		cerr << "Could not find loop points" << endl;
+		return 1;
+	}
+	return 0;
+}
+
 int main(int argc, char** argv) {
 	argc--;
 	argv++;
@@ -44,45 +308,107 @@ int main(int argc, char** argv) {
 		return usage();
 	}
 
-	bool forceLoop = false;
-	bool forceNoLoop = false;
-	int loopStart = 0, loopEnd = 0;
-	const char* inputFile = NULL;
-	const char* outputFile = NULL;
+	if (!strcmp(*argv, "-client")) {
+		if (argc < 2) return usage();
+		return daemon::client(argv[1], argc - 2, argv + 2);
+	}
+	if (!strcmp(*argv, "-info")) {
+		if (argc < 2) return usage();
+		return inspector::info(argc - 1, argv + 1);
+	}
+	if (!strcmp(*argv, "-scan")) {
+		if (argc == 2) return inspector::scan(argv[1], 0);
+		if (argc == 4 && !strcmp(argv[2], "-threads")) return inspector::scan(argv[1], atoi(argv[3]));
+		return usage();
+	}
+	if (!strcmp(*argv, "-patch")) {
+		return patcher::run(argc - 1, argv + 1);
+	}
+	if (!strcmp(*argv, "-splice")) {
+		return splicer::run(argc - 1, argv + 1);
+	}
+	if (!strcmp(*argv, "-remux")) {
+		return remux::run(argc - 1, argv + 1);
+	}
+	if (!strcmp(*argv, "-decode")) {
+		return decoder::run(argc - 1, argv + 1);
+	}
+	if (!strcmp(*argv, "-reencode")) {
+		return reencoder::run(argc - 1, argv + 1);
+	}
+	if (!strcmp(*argv, "-findloop")) {
+		if (argc < 2) return usage();
+		return find_loops(argv[1], argc - 2, argv + 2);
+	}
+	if (!strcmp(*argv, "-bench")) {
+		if (argc < 2) return usage();
+		bench::BenchOptions options;
+		options.outputFile = argv[1];
+		for (int i = 2; i < argc; i += 2) {
+			if (i + 1 >= argc) return usage();
+			if (!strcmp(argv[i], "-baseline")) options.baselineFile = argv[i + 1];
+			else if (!strcmp(argv[i], "-threshold")) options.threshold = atof(argv[i + 1]);
+			else if (!strcmp(argv[i], "-repeat")) options.repeat = atoi(argv[i + 1]);
+			else if (!strcmp(argv[i], "-only")) options.only = argv[i + 1];
+			else if (!strcmp(argv[i], "-concurrent")) options.concurrent = atoi(argv[i + 1]);
+			else return usage();
+		}
+		return bench::run(options);
+	}
+	bool daemonMode = false;
+	const char* socketPath = NULL;
+	const char* batchFile = NULL;
+	int workers = 0;
+
+	EncodeJob job;
+	const char* cacheDir = NULL;
+	const char* statsFile = NULL;
+	const char* indexDir = NULL;
+	std::vector<SplitTarget> splits;
 
 	while (argc > 0) {
 		if (!strcmp(*argv, "/?") || !strcmp(*argv, "-h") || !strcmp(*argv, "--help")) {
 			return usage();
-		} else if ((*argv)[0] == '-' && (*argv)[1] == 'l') {
-			forceLoop = true;
-			forceNoLoop = false;
-
-			loopStart = 0;
-			char* ptr = *argv + 2;
-			while (*ptr >= '0' && *ptr <= '9') {
-				// Parse digit
-				loopStart = loopStart * 10 + (*ptr - '0');
-                ptr++;
+		} else if (job.parse_option(*argv)) {
+			// Loop options
+		} else if (!strcmp(*argv, "-cache")) {
+			if (argc < 2) {
+				cerr << "-cache requires a directory" << endl;
+				return 1;
 			}
-			if (*ptr == '-') {
-				// Get loop end
-				loopEnd = 0;
-				ptr++;
-				while (*ptr >= '0' && *ptr <= '9') {
-					// Parse digit
-					loopEnd = loopEnd * 10 + (*ptr - '0');
-                    ptr++;
-				}
-			} else {
-				loopEnd = 0;
-			}
-		} else if (!strcmp(*argv, "-noloop")) {
-			forceNoLoop = true;
-			forceLoop = false;
-		} else if (inputFile == NULL) {
-			inputFile = *argv;
-		} else if (outputFile == NULL) {
-			outputFile = *argv;
+			argc--;
+			argv++;
+			cacheDir = *argv;
+		} else if (!strcmp(*argv, "-stats") && argc >= 2) {
+			argc--;
+			argv++;
+			statsFile = *argv;
+		} else if (!strcmp(*argv, "-index") && argc >= 2) {
+			argc--;
+			argv++;
+			indexDir = *argv;
+		} else if (!strcmp(*argv, "-daemon") && argc >= 2) {
+			argc--;
+			argv++;
+			daemonMode = true;
+			socketPath = *argv;
+		} else if (!strcmp(*argv, "-split") && argc >= 3) {
+			SplitTarget target = { argv[1], argv[2] };
+			splits.push_back(target);
+			argc -= 2;
+			argv += 2;
+		} else if (!strcmp(*argv, "-batch") && argc >= 2) {
+			argc--;
+			argv++;
+			batchFile = *argv;
+		} else if (!strcmp(*argv, "-workers") && argc >= 2) {
+			argc--;
+			argv++;
+			workers = atoi(*argv);
+		} else if (job.inputFile == NULL) {
+			job.inputFile = *argv;
+		} else if (job.outputFile == NULL) {
+			job.outputFile = *argv;
 		} else {
 			cerr << "Too many arguments: " << *argv << endl;
 			return 1;
@@ -91,15 +417,52 @@ int main(int argc, char** argv) {
 		argv++;
 	}
 
+	if (daemonMode) {
+		return daemon::serve(socketPath, workers, cacheDir);
+	}
+	if (batchFile != NULL) {
+		return batch::run(batchFile, workers, cacheDir);
+	}
+
+	const char* inputFile = job.inputFile;
+	const char* outputFile = job.outputFile;
 	if (inputFile == NULL) {
 		cerr << "No input file specified" << endl;
 		return 1;
 	}
+	if (!splits.empty()) {
+		if (outputFile != NULL) {
+			cerr << "Too many arguments: " << outputFile << endl;
+			return 1;
+		}
+		return split_outputs(job, splits, cacheDir);
+	}
 	if (outputFile == NULL) {
 		cerr << "No output file specified" << endl;
 		return 1;
 	}
 
+	int type = job.output_type();
+	if (type < 0) {
+		cerr << "Unsupported output format: " << outputFile << endl;
+		return 1;
+	}
+
+	BuildIndex* index = NULL;
+	uint64_t indexKey;
+	if (indexDir != NULL) {
+		//Statistics only come out of an encode, so with -stats the index is recorded but not used
+		index = new BuildIndex(indexDir);
+		if (!BuildIndex::key(job, type, &indexKey)) {
+			delete index;
+			index = NULL;
+		} else if (statsFile == NULL && index->restore(indexKey, outputFile)) {
+			cerr << "Up to date: " << outputFile << endl;
+			delete index;
+			return 0;
+		}
+	}
+
 	FILE* inFile = fopen(inputFile, "rb");
 	if (inFile == NULL) {
 		cerr << "Could not open file: " << inputFile << endl;
@@ -117,40 +480,41 @@ int main(int argc, char** argv) {
 	fread(tag, 1, 4, inFile);
 	fseek(inFile, 0, SEEK_SET);
 
-	const char* ext = outputFile;
-	ext += strlen(outputFile);
-	while (ext > outputFile && ext[0] != '.') {
-		ext--;
-	}
-	if (!strcmp(".brstm", ext) && !strcmp(".bcstm", ext) && !strcmp(".bfstm", ext) && !strcmp(".bcwav", ext)) {
-		cerr << "Unsupported output format: " << ext << endl;
-		return 1;
-	}
-
 	if (!strcmp("RIFF", tag)) {
 		try {
 			PCM16* wav = wavfactory::from_file(inFile);
-			if (forceNoLoop) wav->looping = false;
-			if (forceLoop) {
-				wav->looping = true;
-				wav->loop_start = (wav->samples + loopStart * wav->channels);
-				if (loopEnd == 0) {
-					wav->loop_end = wav->samples_end;
-				} else {
-					wav->loop_end = (wav->samples + loopEnd * wav->channels);
-				}
+			job.apply_loop(wav);
+			encoder::EncodeOptions options;
+			if (cacheDir != NULL) {
+				options.coefCache = new CoefCache(cacheDir);
+			}
+			job.apply_options(wav, &options);
+			QualityReport report;
+			LevelMeter levels;
+			if (statsFile != NULL) {
+				options.report = &report;
+				options.levels = &levels;
 			}
-            std::map<std::string, int> fileType = {
-                {".brstm", encoder::FileType::RSTM},
-                {".bcstm", encoder::FileType::CSTM},
-                {".bcwav", encoder::FileType::CWAV},
-                {".bfstm", encoder::FileType::BFSTM}
-            };
 			ProgressTracker progress;
 			int size;
-            int type = fileType[ext];
-            char* output = (char*)encoder::encode(wav, &progress, &size, type);
+            char* output = (char*)encoder::encode(wav, &progress, &size, type, &options);
+            delete options.coefCache;
             delete wav;
+			if (output == NULL) {
+				throw std::runtime_error("Unsupported output format");
+			}
+			if (statsFile != NULL) {
+				FILE* stats = fopen(statsFile, "w");
+				if (stats == NULL) {
+					cerr << "Could not open file for writing: " << statsFile << endl;
+				} else {
+					report.write_json(stats, &levels);
+					fclose(stats);
+				}
+			}
+			if (index != NULL) {
+				index->record(indexKey, output, size);
+			}
 			char* ptr = output;
 			while (size > 0) {
 				int r = fwrite(ptr, 1, size, outFile);
@@ -174,4 +538,5 @@ int main(int argc, char** argv) {
 
 	fclose(inFile);
 	fclose(outFile);
+	delete index;
 }
@@ -0,0 +1,135 @@
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include "mappedfile.h"
+
+#if defined _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace rstmcpp;
+
+#if defined _WIN32
+
+MappedFile::MappedFile() : address(NULL), length(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL) {}
+
+bool MappedFile::open(const char* path, bool writable) {
+	close();
+
+	fileHandle = CreateFileA(path, writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(fileHandle, &size)) {
+		close();
+		return false;
+	}
+	length = (size_t)size.QuadPart;
+	if (length == 0) return true;
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, writable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle == NULL) {
+		close();
+		return false;
+	}
+	address = (uint8_t*)MapViewOfFile(mappingHandle, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+	if (address == NULL) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (address != NULL) UnmapViewOfFile(address);
+	if (mappingHandle != NULL) CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE) CloseHandle(fileHandle);
+	address = NULL;
+	length = 0;
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+}
+
+bool MappedFile::flush() {
+	return address == NULL || (FlushViewOfFile(address, length) && FlushFileBuffers(fileHandle));
+}
+
+#else
+
+MappedFile::MappedFile() : address(NULL), length(0) {}
+
+bool MappedFile::open(const char* path, bool writable) {
+	close();
+
+	int fd = ::open(path, writable ? O_RDWR : O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		return false;
+	}
+	length = (size_t)st.st_size;
+	if (length == 0) {
+		::close(fd);
+		return true;
+	}
+
+	void* p = mmap(NULL, length, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) {
+		length = 0;
+		return false;
+	}
+	address = (uint8_t*)p;
+	return true;
+}
+
+void MappedFile::close() {
+	if (address != NULL) munmap(address, length);
+	address = NULL;
+	length = 0;
+}
+
+bool MappedFile::flush() {
+	return address == NULL || msync(address, length, MS_SYNC) == 0;
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+	close();
+}
+
+static std::atomic<unsigned> tmpCounter(0);
+
+bool rstmcpp::write_file_atomically(const char* path, const void* data, size_t length) {
+	char suffix[48];
+#if defined _WIN32
+	snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", _getpid(), tmpCounter++);
+#else
+	snprintf(suffix, sizeof(suffix), ".%d.%u.tmp", (int)getpid(), tmpCounter++);
+#endif
+	std::string tmpPath = std::string(path) + suffix;
+
+	FILE* file = fopen(tmpPath.c_str(), "wb");
+	if (file == NULL) return false;
+	bool ok = fwrite(data, 1, length, file) == length;
+	ok = (fclose(file) == 0) && ok;
+
+#if defined _WIN32
+	// rename() won't replace an existing file on Windows
+	if (ok) remove(path);
+#endif
+	if (!ok || rename(tmpPath.c_str(), path) != 0) {
+		remove(tmpPath.c_str());
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rstmcpp {
+	// A whole file mapped into memory (mmap, or a file mapping on Windows).
+	class MappedFile {
+	public:
+		MappedFile();
+		~MappedFile();
+
+		// Returns false if the file can't be opened or mapped. Empty files map to a null pointer.
+		bool open(const char* path, bool writable = false);
+		void close();
+
+		uint8_t* data() const { return address; }
+		size_t size() const { return length; }
+
+		// Flushes changes made through a writable mapping to disk.
+		bool flush();
+
+	private:
+		MappedFile(const MappedFile&);
+		MappedFile& operator=(const MappedFile&);
+
+		uint8_t* address;
+		size_t length;
+#if defined _WIN32
+		void* fileHandle;
+		void* mappingHandle;
+#endif
+	};
+
+	// Writes data to a name unique to this process and call, then renames it to path, so
+	// readers only ever see a missing file or a complete one. Replaces an existing file.
+	// Returns false if anything fails; the temporary file is removed.
+	bool write_file_atomically(const char* path, const void* data, size_t length);
+}
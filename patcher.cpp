@@ -0,0 +1,226 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include "patcher.h"
+#include "dspadpcm.h"
+#include "encoder.h"
+#include "inspector.h"
+#include "mappedfile.h"
+
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::inspector;
+using namespace rstmcpp::patcher;
+
+Patch::Patch() : looped(-1), loopStart(-1), loopEnd(-1), sampleRate(0) {}
+
+namespace {
+	struct LoopHistory {
+		int lps;
+		int yn1;
+		int yn2;
+	};
+
+	// Block fields for a stream cut to numSamples
+	struct Layout {
+		uint32_t numBlocks;
+		uint32_t lastBlockSize;
+		uint32_t lastBlockSamples;
+		uint32_t lastBlockTotal;
+	};
+
+	void check(size_t size, size_t offset, size_t length) {
+		if (offset > size || length > size - offset)
+			throw std::runtime_error("Header points outside the file");
+	}
+
+	// Decodes one channel from the start of the block holding loopStart up to it
+	LoopHistory read_loop_history(const uint8_t* data, size_t size, const StreamInfo& info, int channel, uint32_t loopStart) {
+		const ChannelInfo& c = info.channelInfo[channel];
+		uint32_t offset;
+		size_t blockOffset;
+		int yn1 = c.yn1, yn2 = c.yn2;
+
+		if (info.type == encoder::FileType::CWAV) {
+			offset = loopStart;
+			blockOffset = info.dataOffset + (size_t)channel * info.lastBlockTotal;
+		} else {
+			uint32_t block = loopStart / info.samplesPerBlock;
+			offset = loopStart - block * info.samplesPerBlock;
+			blockOffset = block_offset(info, block, channel);
+			block_history(data, size, info, block, channel, &yn1, &yn2);
+		}
+
+		uint32_t frame = offset / 14;
+		check(size, blockOffset, ((size_t)frame + 1) * 8);
+		const uint8_t* p = data + blockOffset;
+
+		int16_t samples[14];
+		for (uint32_t f = 0; f < frame; f++)
+			dspadpcm::decode_frame(p + f * 8, c.coefs, 14, samples, &yn1, &yn2);
+		dspadpcm::decode_frame(p + frame * 8, c.coefs, offset % 14, samples, &yn1, &yn2);
+
+		LoopHistory h = { p[frame * 8], yn1, yn2 };
+		return h;
+	}
+
+	template <typename DataInfo>
+	void set_stream_fields(DataInfo* d, bool looped, uint32_t loopStart, uint32_t numSamples, uint32_t sampleRate) {
+		d->_format._looped = looped ? 1 : 0;
+		d->_loopStartSample = loopStart;
+		d->_numSamples = numSamples;
+		d->_sampleRate = sampleRate;
+	}
+
+	template <typename DataInfo>
+	void set_block_fields(DataInfo* d, const Layout& layout) {
+		d->_numBlocks = layout.numBlocks;
+		d->_lastBlockSize = layout.lastBlockSize;
+		d->_lastBlockSamples = layout.lastBlockSamples;
+		d->_lastBlockTotal = layout.lastBlockTotal;
+	}
+
+	template <typename AdpcmInfo>
+	void set_loop_history(AdpcmInfo* a, const LoopHistory& h) {
+		a->_lps = (int16_t)h.lps;
+		a->_lyn1 = (int16_t)h.yn1;
+		a->_lyn2 = (int16_t)h.yn2;
+	}
+}
+
+void patcher::apply(uint8_t* data, size_t size, const Patch& patch) {
+	StreamInfo info = read_info(data, size);
+	if (info.encoding != 2)
+		throw std::runtime_error("Only DSP-ADPCM streams can be patched");
+	if (info.type != encoder::FileType::CWAV && (info.samplesPerBlock == 0 || info.blockSize == 0 || info.numBlocks == 0))
+		throw std::runtime_error("Stream has no blocks");
+
+	bool looped = patch.looped < 0 ? info.looped : patch.looped != 0;
+	uint32_t loopStart = patch.loopStart >= 0 ? (uint32_t)patch.loopStart : info.loopStart;
+	uint32_t numSamples = patch.loopEnd >= 0 ? (uint32_t)patch.loopEnd : info.numSamples;
+	uint32_t sampleRate = patch.sampleRate > 0 ? (uint32_t)patch.sampleRate : info.sampleRate;
+
+	//Samples actually present in the data, which a new end can't go past
+	uint64_t capacity;
+	if (info.type == encoder::FileType::CWAV)
+		capacity = (uint64_t)(info.channels > 1 ? info.lastBlockTotal : info.dataSize) / 8 * 14;
+	else
+		capacity = (uint64_t)(info.numBlocks - 1) * info.samplesPerBlock + info.lastBlockSamples;
+	if (numSamples == 0 || numSamples > capacity)
+		throw std::invalid_argument("The loop end must be between 1 and the number of encoded samples");
+	if (looped && loopStart >= numSamples)
+		throw std::invalid_argument("The loop start must be before the loop end");
+	if (info.type == encoder::FileType::RSTM && sampleRate > 0xFFFF)
+		throw std::invalid_argument("RSTM sample rates must be below 65536");
+	if (!looped) loopStart = 0;
+
+	Layout layout = {};
+	if (info.type != encoder::FileType::CWAV) {
+		layout.numBlocks = (numSamples + info.samplesPerBlock - 1) / info.samplesPerBlock;
+		layout.lastBlockSamples = numSamples - (layout.numBlocks - 1) * info.samplesPerBlock;
+		layout.lastBlockSize = (layout.lastBlockSamples + 13) / 14 * 8;
+		//An earlier block becomes the last one, but it is still stored at full size
+		layout.lastBlockTotal = layout.numBlocks == info.numBlocks ? info.lastBlockTotal : info.blockSize;
+	}
+
+	//Read everything before writing anything
+	vector<LoopHistory> history(info.channels);
+	for (int c = 0; c < info.channels; c++) {
+		if (looped) {
+			history[c] = read_loop_history(data, size, info, c, loopStart);
+		} else {
+			LoopHistory none = { 0, 0, 0 };
+			history[c] = none;
+		}
+	}
+
+	uint8_t* dataInfo = data + info.dataInfoOffset;
+	switch (info.type) {
+		case encoder::FileType::RSTM:
+			set_stream_fields((StrmDataInfo*)dataInfo, looped, loopStart, numSamples, sampleRate);
+			set_block_fields((StrmDataInfo*)dataInfo, layout);
+			for (int c = 0; c < info.channels; c++)
+				set_loop_history((ADPCMInfo*)(data + info.channelInfo[c].infoOffset), history[c]);
+			break;
+		case encoder::FileType::CSTM:
+		case encoder::FileType::BFSTM:
+			set_stream_fields((CSTMDataInfo*)dataInfo, looped, loopStart, numSamples, sampleRate);
+			set_block_fields((CSTMDataInfo*)dataInfo, layout);
+			for (int c = 0; c < info.channels; c++)
+				set_loop_history((CSTMADPCMInfo*)(data + info.channelInfo[c].infoOffset), history[c]);
+			break;
+		case encoder::FileType::CWAV:
+			set_stream_fields((CWAVDataInfo*)dataInfo, looped, loopStart, numSamples, sampleRate);
+			for (int c = 0; c < info.channels; c++)
+				set_loop_history((CWAVADPCMInfo*)(data + info.channelInfo[c].infoOffset), history[c]);
+			break;
+	}
+}
+
+void patcher::apply_to_file(const char* path, const Patch& patch) {
+	MappedFile file;
+	if (!file.open(path, true))
+		throw std::runtime_error("Could not open file for writing");
+	apply(file.data(), file.size(), patch);
+	if (!file.flush())
+		throw std::runtime_error("Could not write file");
+}
+
+static bool parse_range(const char* arg, int* start, int* end) {
+	char* p;
+	*start = (int)strtol(arg, &p, 10);
+	if (p == arg || *p != '-') return false;
+	const char* q = p + 1;
+	*end = (int)strtol(q, &p, 10);
+	return p != q && *p == '\0' && *start >= 0 && *end > 0;
+}
+
+int patcher::run(int argc, char** argv) {
+	Patch patch;
+	int i = 0;
+	for (; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-noloop")) {
+			patch.looped = 0;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "%s requires a value\n", argv[i]);
+			return 1;
+		}
+		const char* value = argv[++i];
+		if (!strcmp(argv[i - 1], "-loop")) {
+			if (!parse_range(value, &patch.loopStart, &patch.loopEnd)) {
+				fprintf(stderr, "-loop takes <start>-<end>\n");
+				return 1;
+			}
+			patch.looped = 1;
+		} else if (!strcmp(argv[i - 1], "-loopstart")) {
+			patch.loopStart = atoi(value);
+			patch.looped = 1;
+		} else if (!strcmp(argv[i - 1], "-loopend")) {
+			patch.loopEnd = atoi(value);
+		} else if (!strcmp(argv[i - 1], "-rate")) {
+			patch.sampleRate = atoi(value);
+		} else {
+			fprintf(stderr, "Unknown option: %s\n", argv[i - 1]);
+			return 1;
+		}
+	}
+	if (i == argc) {
+		fprintf(stderr, "No files given\n");
+		return 1;
+	}
+
+	int failures = 0;
+	for (; i < argc; i++) {
+		try {
+			apply_to_file(argv[i], patch);
+		} catch (std::exception& e) {
+			fprintf(stderr, "%s: %s\n", argv[i], e.what());
+			failures++;
+		}
+	}
+	return failures > 0 ? 1 : 0;
+}
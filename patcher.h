@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rstmcpp {
+	namespace patcher {
+		// Header fields to change; anything left at its default is kept.
+		struct Patch {
+			int looped; //1 to loop, 0 not to, -1 to keep
+			int loopStart; //-1 to keep
+			int loopEnd; //The sample count, which is also where a loop ends; -1 to keep
+			int sampleRate; //0 to keep
+
+			Patch();
+		};
+
+		// Changes the loop flag, loop points and sample rate of an RSTM, CSTM, FSTM or CWAV
+		// file image in place, without re-encoding. A new loop end may cut the stream short
+		// but not extend it past the encoded samples; the block count and last-block fields
+		// follow it. The loop start frame's predictor/scale and history are re-derived by
+		// decoding from the start of the one block that holds it, using the ADPC/SEEK history
+		// for that block (from the start of the channel for CWAV, which has none). Turning
+		// looping off clears the loop start and history, as the encoder does.
+		//
+		// Throws std::invalid_argument if the patch doesn't fit the file and
+		// std::runtime_error if the file is malformed; nothing is written in either case.
+		void apply(uint8_t* data, size_t size, const Patch& patch);
+
+		// Maps path for writing, applies patch and flushes it to disk.
+		void apply_to_file(const char* path, const Patch& patch);
+
+		// -patch [-loop <start>-<end> | -loopstart <n> | -loopend <n> | -noloop] [-rate <hz>] <file>...
+		// Applies the same patch to every file. Returns a process exit code.
+		int run(int argc, char** argv);
+	}
+}
@@ -10,11 +10,14 @@ using namespace rstmcpp::endian;
 
 void PCM16::initWav(int channels, int sampleRate, int16_t* sample_data, int sample_count, int loop_start, int loop_end) {
 	if (channels > 65535) throw std::invalid_argument("Streams of more than 65535 channels not supported");
-	if (channels <= 0) throw new std::invalid_argument("Number of channels must be a positive integer");
-	if (sampleRate <= 0) throw new std::invalid_argument("Sample rate must be a positive integer");
+	if (channels <= 0) throw std::invalid_argument("Number of channels must be a positive integer");
+	if (sampleRate <= 0) throw std::invalid_argument("Sample rate must be a positive integer");
 
 	if (loop_start >= 0 && loop_end > sample_count / channels) {
-		throw new std::invalid_argument("The end of the loop is past the end of the file. Double-check the program that generated this data.");
+		throw std::invalid_argument("The end of the loop is past the end of the file. Double-check the program that generated this data.");
+	}
+	if (loop_start >= 0 && loop_end <= loop_start) {
+		throw std::invalid_argument("Loop points must satisfy 0 <= start < end <= frame count");
 	}
 
 	this->channels = channels;
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstdint>
+
 namespace rstmcpp {
 	namespace pcm16 {
 		struct PCM16 {
@@ -4,11 +4,13 @@ namespace rstmcpp {
 	class ProgressTracker {
 	public:
 		ProgressTracker();
+		virtual ~ProgressTracker() {}
 
-		void update(float value);
-		void begin(float min, float max, float current);
-		void finish();
-		void cancel();
+		// The default implementation draws a bar on stdout; override to report progress elsewhere.
+		virtual void update(float value);
+		virtual void begin(float min, float max, float current);
+		virtual void finish();
+		virtual void cancel();
 
 		float minValue;
 		float maxValue;
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include "quality.h"
+
+using namespace rstmcpp;
+
+QualityReport::Stats::Stats() : signalEnergy(0), errorEnergy(0), peakError(0), clipped(0), samples(0) {}
+
+void QualityReport::Stats::merge(const Stats& other) {
+	signalEnergy += other.signalEnergy;
+	errorEnergy += other.errorEnergy;
+	if (other.peakError > peakError) peakError = other.peakError;
+	clipped += other.clipped;
+	samples += other.samples;
+}
+
+bool QualityReport::Stats::snr(double* out) const {
+	if (signalEnergy <= 0 || errorEnergy <= 0) return false;
+	*out = 10 * log10(signalEnergy / errorEnergy);
+	return true;
+}
+
+QualityReport::QualityReport(int worstBlockCount) : worstBlockCount(worstBlockCount), sampleRate(0), trimSamples(0) {}
+
+void QualityReport::begin(int channels, int sampleRate, int totalSamples, int trimSamples) {
+	this->sampleRate = sampleRate;
+	this->trimSamples = trimSamples;
+	this->channels.assign(channels, Stats());
+	this->blocks.assign(channels, std::vector<Stats>((totalSamples + 0x37FF) / 0x3800));
+	this->estimated.clear();
+	this->full.clear();
+}
+
+void QualityReport::set_analysis(int channel, const Stats& estimated, const Stats& full) {
+	if (this->estimated.empty()) {
+		this->estimated.resize(channels.size());
+		this->full.resize(channels.size());
+	}
+	this->estimated[channel] = estimated;
+	this->full[channel] = full;
+}
+
+void QualityReport::add(int channel, int sampleIndex, const int16_t* original, const int16_t* decoded, int count) {
+	Stats frame;
+	for (int i = 0; i < count; i++) {
+		int error = decoded[i] - original[i];
+		frame.signalEnergy += (double)original[i] * original[i];
+		frame.errorEnergy += (double)error * error;
+		if (abs(error) > frame.peakError) frame.peakError = abs(error);
+		if ((decoded[i] == 32767 || decoded[i] == -32768) && decoded[i] != original[i]) frame.clipped++;
+	}
+	frame.samples = count;
+
+	channels[channel].merge(frame);
+	blocks[channel][sampleIndex / 0x3800].merge(frame);
+}
+
+QualityReport::Stats QualityReport::total() const {
+	Stats all;
+	for (size_t i = 0; i < channels.size(); i++)
+		all.merge(channels[i]);
+	return all;
+}
+
+static void write_stats(FILE* file, const QualityReport::Stats& stats) {
+	double snr;
+	if (stats.snr(&snr))
+		fprintf(file, "\"snr\": %.3f", snr);
+	else
+		fprintf(file, "\"snr\": null");
+	fprintf(file, ", \"peakError\": %d, \"clipped\": %d, \"samples\": %d", stats.peakError, stats.clipped, stats.samples);
+}
+
+struct BlockRef {
+	int channel;
+	int block;
+	double snr;
+};
+
+static void write_db(FILE* file, const char* name, double value) {
+	if (std::isfinite(value))
+		fprintf(file, "\"%s\": %.2f", name, value);
+	else
+		fprintf(file, "\"%s\": null", name);
+}
+
+static void write_levels(FILE* file, const LevelMeter& levels) {
+	// Measured on the output channels before gain was applied
+	fprintf(file, "  \"output\": {");
+	write_db(file, "gain", 20 * log10(levels.gain));
+	fprintf(file, ", ");
+	write_db(file, "loudness", levels.loudness());
+	fprintf(file, ", \"channels\": [");
+	for (int c = 0; c < levels.channel_count(); c++) {
+		fprintf(file, "%s{", c == 0 ? "" : ", ");
+		write_db(file, "peak", levels.peak_db(c));
+		fprintf(file, ", ");
+		write_db(file, "rms", levels.rms_db(c));
+		fprintf(file, "}");
+	}
+	fprintf(file, "]},\n");
+}
+
+void QualityReport::write_json(FILE* file, const LevelMeter* levels) const {
+	fprintf(file, "{\n");
+	if (levels != nullptr)
+		write_levels(file, *levels);
+	if (!estimated.empty()) {
+		// Estimated coefficients against the full analysis; a negative difference is the SNR lost
+		fprintf(file, "  \"analysis\": [");
+		for (size_t c = 0; c < estimated.size(); c++) {
+			double e, f;
+			fprintf(file, "%s{", c == 0 ? "" : ", ");
+			if (estimated[c].snr(&e) && full[c].snr(&f))
+				fprintf(file, "\"snr\": %.3f, \"fullSnr\": %.3f, \"difference\": %.3f", e, f, e - f);
+			else
+				fprintf(file, "\"snr\": null, \"fullSnr\": null, \"difference\": null");
+			fprintf(file, "}");
+		}
+		fprintf(file, "],\n");
+	}
+	fprintf(file, "  \"total\": {");
+	write_stats(file, total());
+	fprintf(file, "},\n  \"channels\": [\n");
+
+	std::vector<BlockRef> ranked;
+	for (size_t c = 0; c < channels.size(); c++) {
+		fprintf(file, "    {");
+		write_stats(file, channels[c]);
+		fprintf(file, ",\n     \"blocks\": [");
+		for (size_t b = 0; b < blocks[c].size(); b++) {
+			fprintf(file, "%s{", b == 0 ? "" : ", ");
+			write_stats(file, blocks[c][b]);
+			fprintf(file, "}");
+
+			double snr;
+			if (blocks[c][b].snr(&snr)) {
+				BlockRef ref = { (int)c, (int)b, snr };
+				ranked.push_back(ref);
+			}
+		}
+		fprintf(file, "]}%s\n", c + 1 < channels.size() ? "," : "");
+	}
+
+	// Worst blocks first, with their position in the input (before loop padding)
+	std::sort(ranked.begin(), ranked.end(), [](const BlockRef& a, const BlockRef& b) { return a.snr < b.snr; });
+	if ((int)ranked.size() > worstBlockCount) ranked.resize(worstBlockCount);
+
+	fprintf(file, "  ],\n  \"worstBlocks\": [\n");
+	for (size_t i = 0; i < ranked.size(); i++) {
+		int start = ranked[i].block * 0x3800 + trimSamples;
+		if (start < 0) start = 0;
+		fprintf(file, "    {\"channel\": %d, \"block\": %d, \"seconds\": %.3f, ",
+			ranked[i].channel, ranked[i].block, sampleRate > 0 ? (double)start / sampleRate : 0.0);
+		write_stats(file, blocks[ranked[i].channel][ranked[i].block]);
+		fprintf(file, "}%s\n", i + 1 < ranked.size() ? "," : "");
+	}
+	fprintf(file, "  ]\n}\n");
+}
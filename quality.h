@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "levels.h"
+
+namespace rstmcpp {
+	// Error statistics gathered while encoding, by comparing each frame's input with the
+	// reconstruction dspadpcm::encode_frame leaves in the channel buffer. No separate decode needed.
+	class QualityReport {
+	public:
+		struct Stats {
+			double signalEnergy;
+			double errorEnergy;
+			int peakError;
+			int clipped; //Reconstructed samples the encoder pinned at -32768 or 32767 (the original wasn't)
+			int samples;
+
+			Stats();
+			void merge(const Stats& other);
+			// Signal-to-noise ratio in dB; returns false if it is undefined (no signal or no error).
+			bool snr(double* out) const;
+		};
+
+		QualityReport(int worstBlockCount = 10);
+
+		// Called by the encoder before the first frame. trimSamples, the samples cut off the
+		// front of the input (LoopAlignment::TRIM), is added to stream positions to report them
+		// as input times. Loop padding needs no correction, since it only moves the loop later
+		// and adds samples after the end.
+		void begin(int channels, int sampleRate, int totalSamples, int trimSamples);
+
+		// Records one frame: count samples at stream position sampleIndex of channel.
+		void add(int channel, int sampleIndex, const int16_t* original, const int16_t* decoded, int count);
+
+		// Records how coefficients estimated from part of a channel compare with ones from
+		// the full analysis, each used to encode the whole channel.
+		void set_analysis(int channel, const Stats& estimated, const Stats& full);
+
+		const Stats& channel_stats(int channel) const { return channels[channel]; }
+		Stats total() const;
+
+		// levels, if given, are written too, as the "output" object.
+		void write_json(FILE* file, const LevelMeter* levels = nullptr) const;
+
+	private:
+		int worstBlockCount;
+		int sampleRate;
+		int trimSamples;
+		std::vector<Stats> channels;
+		std::vector<std::vector<Stats> > blocks; //[channel][block]
+		std::vector<Stats> estimated; //Empty unless set_analysis was called
+		std::vector<Stats> full;
+	};
+}
@@ -0,0 +1,216 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "reencoder.h"
+#include "dspadpcm.h"
+#include "encoder.h"
+#include "inspector.h"
+#include "mappedfile.h"
+#include "wavfactory.h"
+
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::inspector;
+using namespace rstmcpp::pcm16;
+using namespace rstmcpp::reencoder;
+
+static const uint32_t BLOCK_FRAMES = BLOCK_SAMPLES / 14;
+
+namespace {
+	// Header fields of one channel that re-encoding may change
+	struct ChannelState {
+		bool psChanged;
+		int ps;
+		bool loopChanged;
+		int lps;
+		int lyn1;
+		int lyn2;
+	};
+
+	uint8_t* frame_at(uint8_t* data, const StreamInfo& info, int channel, uint32_t frame) {
+		return data + block_offset(info, frame / BLOCK_FRAMES, channel) + (size_t)(frame % BLOCK_FRAMES) * 8;
+	}
+
+	void set_block_history(uint8_t* data, const StreamInfo& info, uint32_t block, int channel, int yn1, int yn2) {
+		uint8_t* p = data + info.historyOffset + ((size_t)(block - 1) * info.channels + channel) * 4;
+		if (info.type == encoder::FileType::RSTM) {
+			p[0] = (uint8_t)(yn1 >> 8); p[1] = (uint8_t)yn1;
+			p[2] = (uint8_t)(yn2 >> 8); p[3] = (uint8_t)yn2;
+		} else {
+			p[0] = (uint8_t)yn1; p[1] = (uint8_t)(yn1 >> 8);
+			p[2] = (uint8_t)yn2; p[3] = (uint8_t)(yn2 >> 8);
+		}
+	}
+
+	template <typename AdpcmInfo>
+	void set_channel_state(AdpcmInfo* a, const ChannelState& s) {
+		if (s.psChanged)
+			a->_ps = (int16_t)s.ps;
+		if (s.loopChanged) {
+			a->_lps = (int16_t)s.lps;
+			a->_lyn1 = (int16_t)s.lyn1;
+			a->_lyn2 = (int16_t)s.lyn2;
+		}
+	}
+}
+
+uint64_t reencoder::reencode(uint8_t* data, size_t size, uint32_t start, const int16_t* samples, uint32_t count, int channels, int sampleRate) {
+	if (samples == nullptr || count == 0)
+		throw std::invalid_argument("Nothing to re-encode");
+
+	StreamInfo info = read_info(data, size);
+	if (info.type == encoder::FileType::CWAV)
+		throw std::invalid_argument("CWAV files aren't stored in blocks and can't be partially re-encoded");
+	if (info.encoding != 2)
+		throw std::runtime_error("Only DSP-ADPCM streams can be re-encoded");
+	check_block_fields(info);
+	if (channels != info.channels)
+		throw std::invalid_argument("The replacement has a different number of channels");
+	if ((uint32_t)sampleRate != info.sampleRate)
+		throw std::invalid_argument("The replacement has a different sample rate");
+	if (start >= info.numSamples || count > info.numSamples - start)
+		throw std::invalid_argument("The range runs past the end of the stream");
+
+	//Check everything that will be read or written, so nothing is written before a throw
+	for (int c = 0; c < info.channels; c++) {
+		size_t end = block_offset(info, info.numBlocks - 1, c) + info.lastBlockSize;
+		if (end > size)
+			throw std::runtime_error("Header points outside the file");
+	}
+	if (info.numBlocks > 1 && (info.historyOffset == 0
+		|| (size_t)info.historyOffset + (size_t)(info.numBlocks - 1) * info.channels * 4 > size))
+		throw std::runtime_error("Header points outside the file");
+
+	uint32_t end = start + count;
+	uint32_t totalFrames = (info.numSamples + 13) / 14;
+	uint32_t loopFrame = info.loopStart / 14;
+	uint32_t loopOffset = info.loopStart % 14;
+	uint64_t encoded = 0;
+	vector<ChannelState> states(info.channels);
+
+	for (int c = 0; c < info.channels; c++) {
+		const int16_t* coefs = info.channelInfo[c].coefs;
+		ChannelState& state = states[c];
+		state.psChanged = false;
+		state.loopChanged = false;
+
+		//Decoder state where the first changed frame starts
+		uint32_t f = start / 14;
+		int yn1, yn2;
+		block_state(data, size, info, f / BLOCK_FRAMES, c, &yn1, &yn2);
+		int16_t out[14];
+		for (uint32_t g = f / BLOCK_FRAMES * BLOCK_FRAMES; g < f; g++)
+			dspadpcm::decode_frame(frame_at(data, info, c, g), coefs, 14, out, &yn1, &yn2);
+
+		//Original decoder state, which the new one has to catch up with after the range
+		int syn1 = yn1, syn2 = yn2;
+		for (; f < totalFrames; f++) {
+			uint32_t first = f * 14;
+			if (first >= end && syn1 == yn1 && syn2 == yn2)
+				break;
+
+			int n = (int)std::min<uint32_t>(14, info.numSamples - first);
+			uint8_t* p = frame_at(data, info, c, f);
+			int16_t buffer[16] = { (int16_t)yn2, (int16_t)yn1 };
+			dspadpcm::decode_frame(p, coefs, n, buffer + 2, &syn1, &syn2);
+			for (int i = 0; i < n; i++)
+				if (first + i >= start && first + i < end)
+					buffer[i + 2] = samples[(size_t)(first + i - start) * channels + c];
+
+			dspadpcm::encode_frame(buffer, n, p, coefs);
+			yn1 = buffer[n + 1];
+			yn2 = buffer[n];
+			encoded++;
+
+			if (f == 0) {
+				state.psChanged = true;
+				state.ps = p[0];
+			}
+			if (info.looped && f == loopFrame) {
+				state.loopChanged = true;
+				state.lps = p[0];
+				state.lyn1 = buffer[loopOffset + 1];
+				state.lyn2 = buffer[loopOffset];
+			}
+		}
+
+		//ADPC/SEEK keeps the samples before each block as they were given to the encoder
+		for (uint32_t b = std::max<uint32_t>(1, start / BLOCK_SAMPLES); b < info.numBlocks && b * BLOCK_SAMPLES - 2 < end; b++) {
+			uint32_t s1 = b * BLOCK_SAMPLES - 1, s2 = b * BLOCK_SAMPLES - 2;
+			if (s1 < start) continue;
+			int hyn1, hyn2;
+			block_history(data, size, info, b, c, &hyn1, &hyn2);
+			if (s1 < end) hyn1 = samples[(size_t)(s1 - start) * channels + c];
+			if (s2 >= start && s2 < end) hyn2 = samples[(size_t)(s2 - start) * channels + c];
+			set_block_history(data, info, b, c, hyn1, hyn2);
+		}
+	}
+
+	for (int c = 0; c < info.channels; c++) {
+		uint8_t* adpcm = data + info.channelInfo[c].infoOffset;
+		if (info.type == encoder::FileType::RSTM)
+			set_channel_state((ADPCMInfo*)adpcm, states[c]);
+		else
+			set_channel_state((CSTMADPCMInfo*)adpcm, states[c]);
+	}
+	return encoded;
+}
+
+uint64_t reencoder::reencode_file(const char* path, uint32_t start, const int16_t* samples, uint32_t count, int channels, int sampleRate) {
+	MappedFile file;
+	if (!file.open(path, true))
+		throw std::runtime_error("Could not open file for writing");
+	uint64_t encoded = reencode(file.data(), file.size(), start, samples, count, channels, sampleRate);
+	if (!file.flush())
+		throw std::runtime_error("Could not write file");
+	return encoded;
+}
+
+int reencoder::run(int argc, char** argv) {
+	uint32_t start = 0;
+	int i = 0;
+	if (i + 1 < argc && !strcmp(argv[i], "-at")) {
+		char* p;
+		long n = strtol(argv[i + 1], &p, 10);
+		if (p == argv[i + 1] || *p != '\0' || n < 0) {
+			fprintf(stderr, "-at takes a sample number\n");
+			return 1;
+		}
+		start = (uint32_t)n;
+		i += 2;
+	}
+	if (argc - i != 2) {
+		fprintf(stderr, "-reencode takes a stream file and a WAV file\n");
+		return 1;
+	}
+	const char* path = argv[i];
+	const char* wavPath = argv[i + 1];
+
+	FILE* inFile = fopen(wavPath, "rb");
+	if (inFile == NULL) {
+		fprintf(stderr, "%s: could not open file\n", wavPath);
+		return 1;
+	}
+	std::unique_ptr<PCM16> wav;
+	try {
+		wav.reset(wavfactory::from_file(inFile));
+	} catch (std::exception& e) {
+		fprintf(stderr, "%s: %s\n", wavPath, e.what());
+	}
+	fclose(inFile);
+	if (!wav) return 1;
+
+	try {
+		uint32_t count = (uint32_t)((wav->samples_end - wav->samples) / wav->channels);
+		uint64_t encoded = reencode_file(path, start, wav->samples, count, wav->channels, wav->sampleRate);
+		printf("{\"encoded_frames\":%llu}\n", (unsigned long long)encoded);
+	} catch (std::exception& e) {
+		fprintf(stderr, "%s: %s\n", path, e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rstmcpp {
+	namespace reencoder {
+		// Replaces samples start to start + count of an RSTM, CSTM or FSTM file image in place,
+		// re-encoding only the frames that change with the channels' existing coefficients.
+		// samples holds count interleaved frames with one sample per channel of the file, at
+		// the file's sample rate.
+		//
+		// Encoding starts at the frame holding start, from the decoder state the frames before
+		// it leave. Past the end of the range, frames keep being decoded and re-encoded, one at
+		// a time, until the decoder state matches the original's again, as the splicer does at
+		// its seams; everything else is left as it is. The ADPC/SEEK entries whose samples fall
+		// in the range, the initial predictor/scale and the loop start's predictor/scale and
+		// history are updated when they change.
+		//
+		// Returns the number of frames re-encoded, summed over channels. Throws
+		// std::invalid_argument if the range or the replacement's channels or sample rate don't
+		// fit the file and std::runtime_error if the file is malformed; nothing is written in
+		// either case.
+		uint64_t reencode(uint8_t* data, size_t size, uint32_t start, const int16_t* samples, uint32_t count, int channels, int sampleRate);
+
+		// Maps path for writing, re-encodes the range and flushes it to disk.
+		uint64_t reencode_file(const char* path, uint32_t start, const int16_t* samples, uint32_t count, int channels, int sampleRate);
+
+		// -reencode [-at <sample>] <file> <replacement.wav>
+		// Writes the WAV over the file from the given sample (default 0). Returns a process exit code.
+		int run(int argc, char** argv);
+	}
+}
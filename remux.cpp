@@ -0,0 +1,195 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include "remux.h"
+#include "encoder.h"
+#include "inspector.h"
+#include "job.h"
+#include "mappedfile.h"
+
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::inspector;
+using namespace rstmcpp::remux;
+
+ChannelSource::ChannelSource() : data(nullptr), size(0), channel(0) {}
+
+vector<uint8_t> remux::remux(const vector<ChannelSource>& channels, int type) {
+	if (channels.empty())
+		throw std::invalid_argument("No channels given");
+	if (type != encoder::FileType::RSTM && type != encoder::FileType::CSTM)
+		throw std::invalid_argument("Unsupported output format");
+
+	vector<StreamInfo> infos;
+	for (size_t i = 0; i < channels.size(); i++) {
+		const ChannelSource& source = channels[i];
+		if (source.data == nullptr)
+			throw std::invalid_argument("Channel source has no data");
+
+		StreamInfo info = read_info(source.data, source.size);
+		if (info.type == encoder::FileType::CWAV)
+			throw std::invalid_argument("CWAV files aren't stored in blocks and can't be remuxed");
+		if (info.encoding != 2)
+			throw std::runtime_error("Only DSP-ADPCM streams can be remuxed");
+		check_block_fields(info);
+		if (source.channel < 0 || source.channel >= info.channels)
+			throw std::invalid_argument("Channel number is out of range");
+
+		//Everything this channel's blocks span
+		size_t end = block_offset(info, info.numBlocks - 1, source.channel) + info.lastBlockSize;
+		if (end > source.size)
+			throw std::runtime_error("Header points outside the file");
+
+		if (i > 0) {
+			const StreamInfo& first = infos[0];
+			if (info.numSamples != first.numSamples)
+				throw std::invalid_argument("Channels have different lengths");
+			if (info.sampleRate != first.sampleRate)
+				throw std::invalid_argument("Channels have different sample rates");
+			if (info.looped != first.looped || (info.looped && info.loopStart != first.loopStart))
+				throw std::invalid_argument("Channels have different loop points");
+		}
+		infos.push_back(info);
+	}
+
+	const StreamInfo& first = infos[0];
+	int count = (int)channels.size();
+	if (type == encoder::FileType::RSTM && first.sampleRate > 0xFFFF)
+		throw std::invalid_argument("RSTM sample rates must be below 65536");
+
+	vector<uint8_t> output(encoder::get_rstm_size(count, (int)first.numSamples));
+	encoder::write_rstm_headers(output.data(), count, (int)first.sampleRate, (int)first.numSamples);
+	RSTMHeader* rstm = (RSTMHeader*)output.data();
+	HEADHeader* head = rstm->HEADData();
+	be_int16_t* history = (be_int16_t*)rstm->ADPCData()->Data();
+	uint8_t* data = (uint8_t*)rstm->DATAData()->Data();
+	StrmDataInfo* part1 = head->Part1();
+	part1->_format._looped = first.looped ? 1 : 0;
+	part1->_loopStartSample = first.looped ? first.loopStart : 0;
+	uint32_t blocks = part1->_numBlocks;
+	uint32_t lastBlockTotal = part1->_lastBlockTotal;
+
+	for (int k = 0; k < count; k++) {
+		const ChannelInfo& c = infos[k].channelInfo[channels[k].channel];
+		ADPCMInfo* adpcm = head->GetChannelInfo(k);
+		for (int x = 0; x < 16; x++)
+			adpcm->_coefs[x] = (uint16_t)c.coefs[x];
+		adpcm->_ps = c.ps;
+		adpcm->_yn1 = c.yn1;
+		adpcm->_yn2 = c.yn2;
+		adpcm->_lps = c.lps;
+		adpcm->_lyn1 = c.lyn1;
+		adpcm->_lyn2 = c.lyn2;
+	}
+
+	//Block by block, so both the inputs and the output are read and written front to back
+	for (uint32_t b = 0; b < blocks; b++) {
+		bool last = b == blocks - 1;
+		uint8_t* dst = data + (size_t)b * BLOCK_SIZE * count;
+		for (int k = 0; k < count; k++, dst += last ? lastBlockTotal : BLOCK_SIZE) {
+			const ChannelSource& source = channels[k];
+			const StreamInfo& info = infos[k];
+			memcpy(dst, source.data + block_offset(info, b, source.channel), last ? info.lastBlockSize : BLOCK_SIZE);
+
+			if (b > 0) {
+				int yn1, yn2;
+				block_history(source.data, source.size, info, b, source.channel, &yn1, &yn2);
+				be_int16_t* entry = history + ((size_t)(b - 1) * count + k) * 2;
+				entry[0] = (int16_t)yn1;
+				entry[1] = (int16_t)yn2;
+			}
+		}
+	}
+
+	if (type == encoder::FileType::CSTM) {
+		vector<uint8_t> cstm(output.size());
+		encoder::rstm_to_cstm(rstm, cstm.data());
+		output.swap(cstm);
+	}
+	return output;
+}
+
+// Comma-separated channel numbers
+static bool parse_channels(const char* arg, vector<int>& out) {
+	const char* p = arg;
+	while (true) {
+		char* q;
+		long n = strtol(p, &q, 10);
+		if (q == p || n < 0) return false;
+		out.push_back((int)n);
+		if (*q == '\0') return true;
+		if (*q != ',') return false;
+		p = q + 1;
+	}
+}
+
+int remux::run(int argc, char** argv) {
+	if (argc < 1) {
+		fprintf(stderr, "No output file given\n");
+		return 1;
+	}
+	const char* outputPath = argv[0];
+	int type = type_from_extension(outputPath);
+	if (type != encoder::FileType::RSTM && type != encoder::FileType::CSTM) {
+		fprintf(stderr, "The output must be a .brstm or .bcstm file\n");
+		return 1;
+	}
+
+	vector<std::unique_ptr<MappedFile> > files;
+	vector<ChannelSource> sources;
+	vector<int> selected;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-channels")) {
+			selected.clear();
+			if (i + 1 >= argc || !parse_channels(argv[i + 1], selected)) {
+				fprintf(stderr, "-channels takes a comma-separated list of channel numbers\n");
+				return 1;
+			}
+			i++;
+			continue;
+		}
+
+		std::unique_ptr<MappedFile> file(new MappedFile);
+		if (!file->open(argv[i])) {
+			fprintf(stderr, "%s: could not open file\n", argv[i]);
+			return 1;
+		}
+		ChannelSource source;
+		source.data = file->data();
+		source.size = file->size();
+		if (selected.empty()) {
+			try {
+				int n = read_info(source.data, source.size).channels;
+				for (int c = 0; c < n; c++)
+					selected.push_back(c);
+			} catch (std::exception& e) {
+				fprintf(stderr, "%s: %s\n", argv[i], e.what());
+				return 1;
+			}
+		}
+		for (size_t c = 0; c < selected.size(); c++) {
+			source.channel = selected[c];
+			sources.push_back(source);
+		}
+		files.push_back(std::move(file));
+		selected.clear();
+	}
+	if (sources.empty()) {
+		fprintf(stderr, "No input files given\n");
+		return 1;
+	}
+
+	try {
+		vector<uint8_t> output = remux(sources, type);
+		if (!write_file_atomically(outputPath, output.data(), output.size())) {
+			fprintf(stderr, "%s: could not write file\n", outputPath);
+			return 1;
+		}
+	} catch (std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
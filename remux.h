@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rstmcpp {
+	namespace remux {
+		// One channel of an RSTM, CSTM or FSTM file image.
+		struct ChannelSource {
+			const uint8_t* data;
+			size_t size;
+			int channel;
+
+			ChannelSource();
+		};
+
+		// Builds a stream whose channels are the given ones, in order, by copying each one's
+		// coefficients, history and slice of every block; nothing is decoded or re-encoded.
+		// Extracts channels when they all come from one file and merges them when they come
+		// from several. The sources must agree on sample count, sample rate and loop points.
+		// type is encoder::FileType::RSTM or CSTM.
+		//
+		// Throws std::invalid_argument if the sources don't fit together and
+		// std::runtime_error if an input is malformed.
+		std::vector<uint8_t> remux(const std::vector<ChannelSource>& channels, int type);
+
+		// -remux <outputfile> ([-channels <n>[,<n>...]] <inputfile>)...
+		// Takes every channel of an input that has no -channels. Returns a process exit code.
+		int run(int argc, char** argv);
+	}
+}
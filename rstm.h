@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstddef>
 #include <cstring>
 
 #include "ssbbcommon.h"
@@ -198,4 +199,21 @@ namespace rstmcpp
 		ADPCHeader* ADPCData() { return (ADPCHeader*)((uint8_t*)&_header + _adpcOffset); }
 		RSTMDATAHeader* DATAData() { return (RSTMDATAHeader*)((uint8_t*)&_header + _dataOffset); }
 	};
+
+	// On-disk layouts; HEADHeader::Set and the encoder rely on these
+	static_assert(sizeof(AudioFormatInfo) == 0x04, "AudioFormatInfo layout");
+	static_assert(sizeof(ADPCMInfo) == ADPCMInfo::Size, "ADPCMInfo layout");
+	static_assert(offsetof(ADPCMInfo, _gain) == 0x20, "ADPCMInfo layout");
+	static_assert(offsetof(ADPCMInfo, _lyn2) == 0x2C, "ADPCMInfo layout");
+	static_assert(sizeof(StrmDataInfo) == 0x34, "StrmDataInfo layout"); //Part 2 follows at 0x18 + 0x34
+	static_assert(offsetof(StrmDataInfo, _loopStartSample) == 0x08, "StrmDataInfo layout");
+	static_assert(offsetof(StrmDataInfo, _numBlocks) == 0x14, "StrmDataInfo layout");
+	static_assert(offsetof(StrmDataInfo, _lastBlockTotal) == 0x28, "StrmDataInfo layout");
+	static_assert(offsetof(StrmDataInfo, _bitsPerSample) == 0x30, "StrmDataInfo layout");
+	static_assert(offsetof(HEADHeader, _entries) == 0x08, "HEADHeader layout");
+	static_assert(sizeof(ADPCHeader) == 0x10, "ADPCHeader layout");
+	static_assert(sizeof(RSTMDATAHeader) == 0x10, "RSTMDATAHeader layout");
+	static_assert(sizeof(RSTMHeader) == 0x28, "RSTMHeader layout"); //Padded to 0x40 by Set
+	static_assert(offsetof(RSTMHeader, _headOffset) == 0x10, "RSTMHeader layout");
+	static_assert(offsetof(RSTMHeader, _dataLength) == 0x24, "RSTMHeader layout");
 }
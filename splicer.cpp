@@ -0,0 +1,283 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include "splicer.h"
+#include "dspadpcm.h"
+#include "encoder.h"
+#include "inspector.h"
+#include "job.h"
+#include "mappedfile.h"
+#include "patcher.h"
+
+using std::vector;
+using namespace rstmcpp;
+using namespace rstmcpp::inspector;
+using namespace rstmcpp::splicer;
+
+Segment::Segment() : data(nullptr), size(0), start(0), end(0) {}
+Options::Options() : type(encoder::FileType::RSTM), loopStart(-1) {}
+Stats::Stats() : copiedFrames(0), encodedFrames(0) {}
+
+namespace {
+	struct Source {
+		const uint8_t* data;
+		size_t size;
+		StreamInfo info;
+		uint32_t start;
+		uint32_t end;
+	};
+
+	// One channel's frames in a block of a source, checked against the file size
+	const uint8_t* source_block(const Source& s, uint32_t block, int channel, uint32_t samples) {
+		size_t offset = block_offset(s.info, block, channel);
+		size_t length = (size_t)(samples + 13) / 14 * 8;
+		if (offset > s.size || length > s.size - offset)
+			throw std::runtime_error("Header points outside the file");
+		return s.data + offset;
+	}
+
+	void decode_run(const uint8_t* p, uint32_t samples, const int16_t* coefs, int* yn1, int* yn2) {
+		int16_t out[14];
+		for (; samples > 0; p += 8) {
+			int count = samples < 14 ? (int)samples : 14;
+			dspadpcm::decode_frame(p, coefs, count, out, yn1, yn2);
+			samples -= count;
+		}
+	}
+
+	bool same_coefs(const Source& a, const Source& b, int channel) {
+		return !memcmp(a.info.channelInfo[channel].coefs, b.info.channelInfo[channel].coefs, sizeof(int16_t) * 16);
+	}
+}
+
+vector<uint8_t> splicer::splice(const vector<Segment>& segments, const Options& options, Stats* stats) {
+	if (segments.empty())
+		throw std::invalid_argument("Nothing to splice");
+	if (options.type != encoder::FileType::RSTM && options.type != encoder::FileType::CSTM)
+		throw std::invalid_argument("Unsupported output format");
+
+	vector<Source> sources;
+	uint64_t totalSamples = 0;
+	for (size_t i = 0; i < segments.size(); i++) {
+		const Segment& seg = segments[i];
+		if (seg.data == nullptr)
+			throw std::invalid_argument("Segment has no data");
+
+		Source s = { seg.data, seg.size, read_info(seg.data, seg.size), seg.start, seg.end };
+		const StreamInfo& info = s.info;
+		if (info.type == encoder::FileType::CWAV)
+			throw std::invalid_argument("CWAV files aren't stored in blocks and can't be spliced");
+		if (info.encoding != 2)
+			throw std::runtime_error("Only DSP-ADPCM streams can be spliced");
+		check_block_fields(info);
+
+		if (s.end == 0) s.end = info.numSamples;
+		if (s.start % BLOCK_SAMPLES != 0)
+			throw std::invalid_argument("Segments must start on a block boundary");
+		if (s.start >= s.end || s.end > info.numSamples)
+			throw std::invalid_argument("Segment is empty or runs past the end of its stream");
+		if (i + 1 < segments.size() && s.end % BLOCK_SAMPLES != 0)
+			throw std::invalid_argument("Only the last segment may end between block boundaries");
+		if (i > 0 && info.channels != sources[0].info.channels)
+			throw std::invalid_argument("Segments have different channel counts");
+		if (i > 0 && info.sampleRate != sources[0].info.sampleRate)
+			throw std::invalid_argument("Segments have different sample rates");
+
+		totalSamples += s.end - s.start;
+		sources.push_back(s);
+	}
+
+	int channels = sources[0].info.channels;
+	uint32_t sampleRate = sources[0].info.sampleRate;
+	if (totalSamples > 0x7FFFFFFF - BLOCK_SAMPLES)
+		throw std::invalid_argument("Spliced stream is too long");
+	if (options.type == encoder::FileType::RSTM && sampleRate > 0xFFFF)
+		throw std::invalid_argument("RSTM sample rates must be below 65536");
+	if (options.loopStart >= 0 && (uint64_t)options.loopStart >= totalSamples)
+		throw std::invalid_argument("The loop start must be before the end of the spliced stream");
+
+	vector<uint8_t> output(encoder::get_rstm_size(channels, (int)totalSamples));
+	encoder::write_rstm_headers(output.data(), channels, (int)sampleRate, (int)totalSamples);
+	RSTMHeader* rstm = (RSTMHeader*)output.data();
+	HEADHeader* head = rstm->HEADData();
+	be_int16_t* history = (be_int16_t*)rstm->ADPCData()->Data();
+	uint8_t* data = (uint8_t*)rstm->DATAData()->Data();
+	uint32_t blocks = head->Part1()->_numBlocks;
+	uint32_t lastBlockTotal = head->Part1()->_lastBlockTotal;
+
+	Stats counts;
+	for (int c = 0; c < channels; c++) {
+		//Keep the coefficients that cover the most samples, so the least is re-encoded
+		size_t owner = 0;
+		uint64_t ownerSamples = 0;
+		for (size_t i = 0; i < sources.size(); i++) {
+			uint64_t covered = 0;
+			for (size_t j = 0; j < sources.size(); j++)
+				if (same_coefs(sources[i], sources[j], c)) covered += sources[j].end - sources[j].start;
+			if (covered > ownerSamples) {
+				owner = i;
+				ownerSamples = covered;
+			}
+		}
+		const int16_t* coefs = sources[owner].info.channelInfo[c].coefs;
+
+		//Output decoder state where pending starts; pending frames were copied without decoding
+		int yn1 = 0, yn2 = 0;
+		const uint8_t* pending = nullptr;
+		uint32_t pendingSamples = 0;
+
+		uint32_t outBlock = 0;
+		for (size_t i = 0; i < sources.size(); i++) {
+			const Source& s = sources[i];
+			const int16_t* sourceCoefs = s.info.channelInfo[c].coefs;
+			bool same = same_coefs(s, sources[owner], c);
+
+			decode_run(pending, pendingSamples, coefs, &yn1, &yn2);
+			pending = nullptr;
+			pendingSamples = 0;
+
+			uint32_t first = s.start / BLOCK_SAMPLES;
+			int syn1, syn2;
+			block_state(s.data, s.size, s.info, first, c, &syn1, &syn2);
+			bool copying = same && syn1 == yn1 && syn2 == yn2;
+
+			for (uint32_t block = first; block * BLOCK_SAMPLES < s.end; block++, outBlock++) {
+				uint32_t samples = std::min(s.end, (block + 1) * BLOCK_SAMPLES) - block * BLOCK_SAMPLES;
+				uint32_t frames = (samples + 13) / 14;
+				const uint8_t* src = source_block(s, block, c, samples);
+				uint8_t* dst = data + (size_t)outBlock * BLOCK_SIZE * channels + (size_t)c * (outBlock == blocks - 1 ? lastBlockTotal : BLOCK_SIZE);
+
+				//Copied blocks keep the history their source gives them
+				if (copying && block > first)
+					block_history(s.data, s.size, s.info, block, c, &yn1, &yn2);
+				if (outBlock > 0) {
+					be_int16_t* entry = history + ((size_t)(outBlock - 1) * channels + c) * 2;
+					entry[0] = (int16_t)yn1;
+					entry[1] = (int16_t)yn2;
+				}
+
+				uint32_t f = 0;
+				for (; f < frames && !copying; f++) {
+					int count = std::min(14, (int)(samples - f * 14));
+					int16_t buffer[16] = { (int16_t)yn2, (int16_t)yn1 };
+					dspadpcm::decode_frame(src + f * 8, sourceCoefs, count, buffer + 2, &syn1, &syn2);
+					dspadpcm::encode_frame(buffer, count, dst + f * 8, coefs);
+					yn1 = buffer[count + 1];
+					yn2 = buffer[count];
+					counts.encodedFrames++;
+					copying = same && syn1 == yn1 && syn2 == yn2;
+				}
+
+				memcpy(dst + f * 8, src + f * 8, (frames - f) * 8);
+				counts.copiedFrames += frames - f;
+				pending = dst + f * 8;
+				pendingSamples = samples - std::min(samples, f * 14);
+			}
+		}
+
+		ADPCMInfo* adpcm = head->GetChannelInfo(c);
+		for (int x = 0; x < 16; x++)
+			adpcm->_coefs[x] = (uint16_t)coefs[x];
+		adpcm->_ps = data[(size_t)c * (blocks == 1 ? lastBlockTotal : BLOCK_SIZE)];
+	}
+
+	if (options.type == encoder::FileType::CSTM) {
+		vector<uint8_t> cstm(output.size());
+		encoder::rstm_to_cstm(rstm, cstm.data());
+		output.swap(cstm);
+	}
+
+	if (options.loopStart >= 0) {
+		patcher::Patch patch;
+		patch.looped = 1;
+		patch.loopStart = options.loopStart;
+		patcher::apply(output.data(), output.size(), patch);
+	}
+
+	if (stats != nullptr)
+		*stats = counts;
+	return output;
+}
+
+// <start>-<end>, or <start>- for the rest of the stream
+static bool parse_range(const char* arg, uint32_t* start, uint32_t* end) {
+	char* p;
+	long s = strtol(arg, &p, 10);
+	if (p == arg || *p != '-' || s < 0) return false;
+	const char* q = p + 1;
+	if (*q == '\0') {
+		*start = (uint32_t)s;
+		*end = 0;
+		return true;
+	}
+	long e = strtol(q, &p, 10);
+	if (p == q || *p != '\0' || e <= s) return false;
+	*start = (uint32_t)s;
+	*end = (uint32_t)e;
+	return true;
+}
+
+int splicer::run(int argc, char** argv) {
+	Options options;
+	int i = 0;
+	if (i + 1 < argc && !strcmp(argv[i], "-loopstart")) {
+		options.loopStart = atoi(argv[i + 1]);
+		i += 2;
+	}
+	if (i >= argc) {
+		fprintf(stderr, "No output file given\n");
+		return 1;
+	}
+	const char* outputPath = argv[i++];
+	options.type = type_from_extension(outputPath);
+	if (options.type != encoder::FileType::RSTM && options.type != encoder::FileType::CSTM) {
+		fprintf(stderr, "The output must be a .brstm or .bcstm file\n");
+		return 1;
+	}
+
+	vector<std::unique_ptr<MappedFile> > files;
+	vector<Segment> segments;
+	Segment next;
+	for (; i < argc; i++) {
+		if (!strcmp(argv[i], "-range")) {
+			if (i + 1 >= argc || !parse_range(argv[i + 1], &next.start, &next.end)) {
+				fprintf(stderr, "-range takes <start>-<end> or <start>-\n");
+				return 1;
+			}
+			i++;
+			continue;
+		}
+
+		std::unique_ptr<MappedFile> file(new MappedFile);
+		if (!file->open(argv[i])) {
+			fprintf(stderr, "%s: could not open file\n", argv[i]);
+			return 1;
+		}
+		next.data = file->data();
+		next.size = file->size();
+		segments.push_back(next);
+		files.push_back(std::move(file));
+		next = Segment();
+	}
+	if (segments.empty()) {
+		fprintf(stderr, "No input files given\n");
+		return 1;
+	}
+
+	try {
+		Stats stats;
+		vector<uint8_t> output = splice(segments, options, &stats);
+		if (!write_file_atomically(outputPath, output.data(), output.size())) {
+			fprintf(stderr, "%s: could not write file\n", outputPath);
+			return 1;
+		}
+		printf("{\"copied_frames\":%llu,\"encoded_frames\":%llu}\n", (unsigned long long)stats.copiedFrames, (unsigned long long)stats.encodedFrames);
+	} catch (std::exception& e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
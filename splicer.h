@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace rstmcpp {
+	namespace splicer {
+		// A run of whole blocks taken from one RSTM, CSTM or FSTM file image.
+		struct Segment {
+			const uint8_t* data;
+			size_t size;
+			uint32_t start; //First sample; must be on a 0x3800-sample block boundary
+			uint32_t end; //One past the last sample; 0 for the end of the stream
+
+			Segment();
+		};
+
+		struct Options {
+			int type; //encoder::FileType of the output: RSTM or CSTM
+			int loopStart; //Loop start in the output, which loops to its end; -1 for no loop
+
+			Options();
+		};
+
+		// Frames (per channel, summed over channels) copied from the inputs and re-encoded.
+		struct Stats {
+			uint64_t copiedFrames;
+			uint64_t encodedFrames;
+
+			Stats();
+		};
+
+		// Joins the segments, in order, into one stream without decoding most of them: the
+		// ADPCM blocks are copied as they are, and the DATA interleave, ADPC/SEEK table and
+		// last-block fields are rebuilt around them. Each segment must end on a block boundary,
+		// except the last, which may end anywhere; a single segment cuts a stream.
+		//
+		// Every channel keeps the coefficients of the segment that contributes most of its
+		// samples. At each seam the frames after it are decoded (from the ADPC/SEEK history of
+		// their block) and re-encoded from the decoder state the previous segment leaves, one
+		// at a time, until the decoder state matches the original's; the rest is copied. A
+		// segment whose coefficients differ from the output's is re-encoded in full.
+		//
+		// Throws std::invalid_argument if the segments don't fit together (channel count,
+		// sample rate, boundaries) and std::runtime_error if an input is malformed.
+		std::vector<uint8_t> splice(const std::vector<Segment>& segments, const Options& options, Stats* stats = nullptr);
+
+		// -splice [-loopstart <n>] <outputfile> ([-range <start>-[<end>]] <inputfile>)...
+		// Returns a process exit code.
+		int run(int argc, char** argv);
+	}
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace rstmcpp {
+	// Bounded ring buffer between exactly one producer thread and one consumer thread.
+	// The indices are lock-free; the mutex is only taken to sleep when the ring is full
+	// (producer) or empty (consumer), and to wake the other side.
+	template <typename T>
+	class SpscQueue {
+	public:
+		SpscQueue(size_t capacity) : slots(capacity), head(0), tail(0) {}
+
+		// Blocks while the ring is full.
+		void push(const T& item) {
+			size_t t = tail.load(std::memory_order_relaxed);
+			if (t - head.load(std::memory_order_acquire) == slots.size()) {
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]() -> bool { return t - head.load(std::memory_order_acquire) < slots.size(); });
+			}
+			slots[t % slots.size()] = item;
+			tail.store(t + 1, std::memory_order_release);
+			wake();
+		}
+
+		// Blocks while the ring is empty.
+		T pop() {
+			size_t h = head.load(std::memory_order_relaxed);
+			if (tail.load(std::memory_order_acquire) == h) {
+				std::unique_lock<std::mutex> lock(mutex);
+				changed.wait(lock, [&]() -> bool { return tail.load(std::memory_order_acquire) != h; });
+			}
+			T item = slots[h % slots.size()];
+			head.store(h + 1, std::memory_order_release);
+			wake();
+			return item;
+		}
+
+	private:
+		void wake() {
+			// Taking the lock orders this notify after the other side's predicate check
+			{ std::lock_guard<std::mutex> lock(mutex); }
+			changed.notify_one();
+		}
+
+		SpscQueue(const SpscQueue&);
+		SpscQueue& operator=(const SpscQueue&);
+
+		std::vector<T> slots;
+		std::atomic<size_t> head;
+		std::atomic<size_t> tail;
+		std::mutex mutex;
+		std::condition_variable changed;
+	};
+}
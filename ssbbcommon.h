@@ -1,4 +1,5 @@
-﻿#include "endian.h"
+﻿#include <cstddef>
+#include "endian.h"
 
 using namespace rstmcpp::endian;
 
@@ -87,4 +88,10 @@ namespace rstmcpp
 			Entries()[index] = ruint(refType, dataType, (uint8_t*)address - Address());
 		}
 	};
+
+	// On-disk layouts
+	static_assert(sizeof(NW4RCommonHeader) == 0x10, "NW4RCommonHeader layout");
+	static_assert(offsetof(NW4RCommonHeader, _length) == 0x08, "NW4RCommonHeader layout");
+	static_assert(sizeof(ruint) == 0x08, "ruint layout");
+	static_assert(offsetof(ruint, _dataOffset) == 0x04, "ruint layout");
 }
@@ -1,7 +1,9 @@
+#include <new>
 #include <stdexcept>
 #include <cstring>
 #include "endian.h"
 #include "wavfactory.h"
+#include "wavwriter.h"
 
 using namespace rstmcpp::pcm16;
 using namespace rstmcpp::endian;
@@ -71,121 +73,152 @@ struct smpl_loop {
 };
 
 PCM16* wavfactory::from_file(FILE* file) {
-	char buffer[12];
-	int r = fread(buffer, 1, 12, file);
-    if (r == 0) {
+	// Read the whole stream into memory, then parse it from there
+	size_t capacity = 1 << 20;
+	size_t size = 0;
+	char* buffer = (char*)malloc(capacity);
+	if (buffer == NULL) throw std::bad_alloc();
+	size_t r;
+	while ((r = fread(buffer + size, 1, capacity - size, file)) > 0) {
+		size += r;
+		if (size == capacity) {
+			capacity *= 2;
+			char* grown = (char*)realloc(buffer, capacity);
+			if (grown == NULL) {
+				free(buffer);
+				throw std::bad_alloc();
+			}
+			buffer = grown;
+		}
+	}
+
+	try {
+		PCM16* wav = from_buffer(buffer, size);
+		free(buffer);
+		return wav;
+	} catch (...) {
+		free(buffer);
+		throw;
+	}
+}
+
+PCM16* wavfactory::from_buffer(const void* data, size_t size) {
+	const char* ptr = (const char*)data;
+	const char* end = ptr + size;
+
+    if (size == 0) {
 		throw std::runtime_error("No data in stream");
-    } else if (r < 12) {
+    } else if (size < 12) {
 		throw std::runtime_error("Unexpected end of stream in first 12 bytes");
     }
 
-    if (strncmp(buffer, "RIFF", 4) != 0) {
+    if (strncmp(ptr, "RIFF", 4) != 0) {
 		throw std::runtime_error("RIFF header not found");
     }
-	if (strncmp(buffer + 8, "WAVE", 4) != 0) {
+	if (strncmp(ptr + 8, "WAVE", 4) != 0) {
 		throw std::runtime_error("WAVE header not found");
     }
+	ptr += 12;
 
     int channels = 0;
     int sampleRate = 0;
 
-	le_int16_t* sample_data = NULL;
+	const le_int16_t* sample_data = NULL;
 	int sample_data_length_bytes = 0;
     bool convert_from_8_bit = false;
 
     int loopStart = -1;
     int loopEnd;
 
-    // Keep reading chunk headers into a buffer of 8 bytes
-    while ((r = fread(buffer, 1, 8, file)) > 0) {
-        if (r < 8) {
+    // Walk the chunk headers (8 bytes each)
+    while (ptr < end) {
+        if (end - ptr < 8) {
 			throw std::runtime_error("Unexpected end of stream in chunk header");
-        } else {
-            // Four ASCII characters
-			char id[5];
-			id[4] = '\0';
-			strncpy(id, buffer, 4);
-
-			le_int32_t* px = (le_int32_t*)(buffer + 4);
-			int32_t chunklength = *px;
-            chunklength += chunklength % 2; // Make sure odd numbered chunk sizes are padded so that we are aligned correctly while reading chunks
-
-            char* buffer2;
-            if (strcmp(id, "data") == 0 && chunklength == -1) {
-				throw std::runtime_error("No length specified in data chunk");
-            } else {
-                // Look at the length of the chunk and read that many bytes into a byte array.
-				buffer2 = (char*)malloc(chunklength);
-				char* end = buffer2 + chunklength;
-				char* ptr = buffer2;
-				while (ptr < end) {
-					int r = fread(ptr, 1, end - ptr, file);
-					ptr += r;
-					if (r == 0) {
-						char str[128];
-						str[127] = '\0';
-						snprintf(str, 127, "Unexpected end of data in \"%s\" chunk: expected %lu bytes, got %lu bytes", id, end - buffer2, end - ptr);
-						throw std::runtime_error(str);
-					}
-                }
-            }
+        }
 
-            if (!strcmp(id, "fmt ")) {
-                // Format chunk
-				struct fmt* fmt = (struct fmt*)buffer2;
-                if (fmt->format != 1) {
-                    if (fmt->format == 65534) {
-                        // WAVEFORMATEXTENSIBLE
-                        fmt_extensible* ext = (fmt_extensible*)fmt;
-                        if (ext->subFormat == KSDATAFORMAT_SUBTYPE_PCM) {
-                            // KSDATAFORMAT_SUBTYPE_PCM
-                        } else {
-                            throw std::runtime_error("Only uncompressed PCM suppported - found WAVEFORMATEXTENSIBLE with unsupported subformat");
-                        }
-                    } else {
-                        throw std::runtime_error("Only uncompressed PCM suppported - found unknown format");
-                    }
-                } else if (fmt->bitsPerSample != 16) {
-					le_int16_t aa = fmt->bitsPerSample;
-					int16_t ab = aa;
-                    if (fmt->bitsPerSample == 8) {
-                        convert_from_8_bit = true;
+        // Four ASCII characters
+		char id[5];
+		id[4] = '\0';
+		strncpy(id, ptr, 4);
+
+		const le_int32_t* px = (const le_int32_t*)(ptr + 4);
+		int32_t chunklength = *px;
+		ptr += 8;
+
+        if (strcmp(id, "data") == 0 && chunklength == -1) {
+			throw std::runtime_error("No length specified in data chunk");
+        }
+        if (chunklength < 0 || chunklength > end - ptr) {
+			char str[128];
+			str[127] = '\0';
+			snprintf(str, 127, "Unexpected end of data in \"%s\" chunk: expected %ld bytes, got %ld bytes", id, (long)chunklength, (long)(end - ptr));
+			throw std::runtime_error(str);
+        }
+        const char* chunk = ptr;
+
+        if (!strcmp(id, "fmt ")) {
+            // Format chunk
+			if (chunklength < (int32_t)sizeof(struct fmt)) {
+				throw std::runtime_error("Format chunk is too short");
+			}
+			const struct fmt* fmt = (const struct fmt*)chunk;
+            if (fmt->format != 1) {
+                if (fmt->format == 65534) {
+                    // WAVEFORMATEXTENSIBLE
+                    const fmt_extensible* ext = (const fmt_extensible*)fmt;
+                    if (chunklength >= (int32_t)sizeof(fmt_extensible) && ext->subFormat == KSDATAFORMAT_SUBTYPE_PCM) {
+                        // KSDATAFORMAT_SUBTYPE_PCM
                     } else {
-                        throw std::runtime_error("Only 8-bit and 16-bit wave files supported");
+                        throw std::runtime_error("Only uncompressed PCM suppported - found WAVEFORMATEXTENSIBLE with unsupported subformat");
                     }
+                } else {
+                    throw std::runtime_error("Only uncompressed PCM suppported - found unknown format");
                 }
-
-                channels = fmt->channels;
-                sampleRate = fmt->sampleRate;
-            } else if (!strcmp(id, "data")) {
-                // Data chunk - contains samples
-				if (sample_data != NULL) {
-					throw std::runtime_error("Multiple data chunks found");
-				}
-				sample_data = (le_int16_t*)buffer2;
-				sample_data_length_bytes = chunklength;
-            } else if (!strcmp(id, "smpl")) {
-                // sampler chunk
-                struct smpl* smpl = (struct smpl*)buffer2;
-                if (smpl->sampleLoopCount > 1) {
-                    throw std::runtime_error("Cannot read looping .wav file with more than one loop");
-                } else if (smpl->sampleLoopCount == 1) {
-                    // There is one loop - we only care about start and end points
-                    smpl_loop* loop = (smpl_loop*)(smpl + 1);
-                    if (loop->type != 0) {
-                        throw std::runtime_error("Cannot read looping .wav file with loop of type other than 0");
-                    }
-                    loopStart = loop->start;
-                    loopEnd = loop->end;
+            }
+            if (fmt->bitsPerSample != 16) {
+                if (fmt->bitsPerSample == 8) {
+                    convert_from_8_bit = true;
+                } else {
+                    throw std::runtime_error("Only 8-bit and 16-bit wave files supported");
                 }
-            } else {
-                //printf("Ignoring unknown chunk %s\n", id);
             }
 
-			if ((void*)buffer2 != (void*)sample_data) {
-				free(buffer2);
+            channels = fmt->channels;
+            sampleRate = fmt->sampleRate;
+        } else if (!strcmp(id, "data")) {
+            // Data chunk - contains samples
+			if (sample_data != NULL) {
+				throw std::runtime_error("Multiple data chunks found");
+			}
+			sample_data = (const le_int16_t*)chunk;
+			sample_data_length_bytes = chunklength;
+        } else if (!strcmp(id, "smpl")) {
+            // sampler chunk
+			if (chunklength < (int32_t)sizeof(struct smpl)) {
+				throw std::runtime_error("Sampler chunk is too short");
 			}
+            const struct smpl* smpl = (const struct smpl*)chunk;
+            if (smpl->sampleLoopCount > 1) {
+                throw std::runtime_error("Cannot read looping .wav file with more than one loop");
+            } else if (smpl->sampleLoopCount == 1) {
+                // There is one loop - we only care about start and end points
+				if (chunklength < (int32_t)(sizeof(struct smpl) + sizeof(smpl_loop))) {
+					throw std::runtime_error("Sampler chunk is too short");
+				}
+                const smpl_loop* loop = (const smpl_loop*)(smpl + 1);
+                if (loop->type != 0) {
+                    throw std::runtime_error("Cannot read looping .wav file with loop of type other than 0");
+                }
+                loopStart = loop->start;
+                loopEnd = loop->end;
+            }
+        } else {
+            //printf("Ignoring unknown chunk %s\n", id);
         }
+
+        // Odd numbered chunk sizes are padded so that we are aligned correctly while reading chunks
+        ptr += chunklength;
+        if (chunklength % 2 != 0 && ptr < end) ptr++;
     }
 
     if (sampleRate == 0) {
@@ -195,28 +228,31 @@ PCM16* wavfactory::from_file(FILE* file) {
         throw std::runtime_error("Data chunk not found");
     }
 
+	int16_t* sample_data_native;
+	int sample_count;
     if (convert_from_8_bit) {
-        le_int16_t* new_sample_data = (le_int16_t*)malloc(sample_data_length_bytes * 2);
-        uint8_t* ptr = (uint8_t*)sample_data;
-        for (int i = 0; i < sample_data_length_bytes; i++) {
-            new_sample_data[i] = (le_int16_t)((ptr[i] - 0x80) << 8);
+		sample_count = sample_data_length_bytes;
+		sample_data_native = (int16_t*)malloc(sample_count * sizeof(int16_t));
+        const uint8_t* p8 = (const uint8_t*)sample_data;
+        for (int i = 0; i < sample_count; i++) {
+            sample_data_native[i] = (int16_t)((p8[i] - 0x80) << 8);
         }
-
-		free(sample_data);
-        sample_data = new_sample_data;
-		sample_data_length_bytes *= 2;
-    }
-
-	int16_t* sample_data_native = sample_data_native = (int16_t*)malloc(sample_data_length_bytes);
-	for (int i = 0; i < sample_data_length_bytes / 2; i++) {
-		sample_data_native[i] = sample_data[i];
+    } else {
+		sample_count = sample_data_length_bytes / 2;
+		sample_data_native = (int16_t*)malloc(sample_count * sizeof(int16_t));
+		for (int i = 0; i < sample_count; i++) {
+			sample_data_native[i] = sample_data[i];
+		}
 	}
-	free(sample_data);
 
-    PCM16* wav = new PCM16(channels, sampleRate, sample_data_native, sample_data_length_bytes / 2, loopStart, loopEnd);
-
-	free(sample_data_native);
-    return wav;
+	try {
+		PCM16* wav = new PCM16(channels, sampleRate, sample_data_native, sample_count, loopStart, loopEnd);
+		free(sample_data_native);
+		return wav;
+	} catch (...) {
+		free(sample_data_native);
+		throw;
+	}
 }
 
 int wavfactory::get_size(const PCM16* lwav) {
@@ -289,3 +325,14 @@ void wavfactory::export_to_ptr(const PCM16* lwav, void* dest, int size) {
 		ptr += sizeof(struct smpl_loop);
 	}
 }
+
+void wavfactory::export_to_file(const PCM16* lwav, FILE* file) {
+	WavWriter writer;
+	writer.open(file, lwav->channels, lwav->sampleRate);
+	writer.write(lwav->samples, (int)((lwav->samples_end - lwav->samples) / lwav->channels));
+	if (lwav->looping) {
+		writer.set_loop((uint32_t)((lwav->loop_start - lwav->samples) / lwav->channels),
+			(uint32_t)((lwav->loop_end - lwav->samples) / lwav->channels));
+	}
+	writer.close();
+}
@@ -1,14 +1,21 @@
 #pragma once
 
+#include <cstdio>
 #include "pcm16.h"
 
 namespace rstmcpp {
 	namespace pcm16 {
 		namespace wavfactory {
 			PCM16* from_file(FILE* file);
+			PCM16* from_buffer(const void* data, size_t size);
 
+			// Whole-image export: dest must hold get_size(lwav) bytes.
 			int get_size(const PCM16* lwav);
 			void export_to_ptr(const PCM16* lwav, void* dest, int size);
+
+			// Streams the WAV to a seekable file through a WavWriter, without building the
+			// image in memory. Throws std::runtime_error if writing fails.
+			void export_to_file(const PCM16* lwav, FILE* file);
 		}
 	}
 }
\ No newline at end of file
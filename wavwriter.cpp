@@ -0,0 +1,191 @@
+#include <cstring>
+#include <stdexcept>
+#include "endian.h"
+#include "wavwriter.h"
+
+using namespace rstmcpp::endian;
+using namespace rstmcpp::pcm16;
+
+// Chunk ID and length
+struct chunk_header {
+	char id[4];
+	le_uint32_t length;
+};
+
+struct wav_fmt {
+	le_uint16_t format;
+	le_uint16_t channels;
+	le_uint32_t sampleRate;
+	le_uint32_t byteRate;
+	le_uint16_t blockAlign;
+	le_uint16_t bitsPerSample;
+};
+
+// RF64 size table (EBU Tech 3306); written over the JUNK chunk once the file outgrows RIFF
+struct ds64 {
+	le_uint32_t riffSizeLow;
+	le_uint32_t riffSizeHigh;
+	le_uint32_t dataSizeLow;
+	le_uint32_t dataSizeHigh;
+	le_uint32_t sampleCountLow;
+	le_uint32_t sampleCountHigh;
+	le_uint32_t tableLength;
+};
+
+struct wav_smpl {
+	le_uint32_t manufacturer;
+	le_uint32_t product;
+	le_uint32_t samplePeriod;
+	le_uint32_t midiUnityNote;
+	le_uint32_t midiPitchFraction;
+	le_uint32_t smpteFormat;
+	le_uint32_t smpteOffset;
+	le_uint32_t sampleLoopCount;
+	le_uint32_t samplerDataCount;
+	le_uint32_t loopID;
+	le_uint32_t type;
+	le_uint32_t start;
+	le_uint32_t end;
+	le_uint32_t fraction;
+	le_uint32_t playCount;
+};
+
+static_assert(sizeof(ds64) == 28 && sizeof(wav_smpl) == 60, "RF64 and smpl chunks must have no padding");
+
+static const int64_t RIFF_SIZE_OFFSET = 4;
+static const int64_t JUNK_OFFSET = 12;
+static const int64_t DATA_HEADER_OFFSET = JUNK_OFFSET + 8 + sizeof(ds64) + 8 + sizeof(wav_fmt);
+
+static void set_id(chunk_header* header, const char* id) {
+	memcpy(header->id, id, 4);
+}
+
+static int seek(FILE* file, int64_t position) {
+#if defined _WIN32
+	return _fseeki64(file, position, SEEK_SET);
+#else
+	return fseeko(file, (off_t)position, SEEK_SET);
+#endif
+}
+
+WavWriter::WavWriter() : file(NULL), channels(0), blockAlign(2), dataStart(0), dataSize(0), looping(false), loopStart(0), loopEnd(0) {}
+
+void WavWriter::open(FILE* file, int channels, int sampleRate) {
+	if (channels <= 0 || channels > 0xFFFF)
+		throw std::invalid_argument("Invalid channel count");
+
+	this->file = file;
+	this->channels = channels;
+	this->blockAlign = channels * 2;
+	this->dataSize = 0;
+	this->looping = false;
+
+	chunk_header riff;
+	set_id(&riff, "RIFF");
+	riff.length = 0;
+	put(&riff, sizeof(riff));
+	put("WAVE", 4);
+
+	chunk_header junk;
+	set_id(&junk, "JUNK");
+	junk.length = sizeof(ds64);
+	ds64 reserved = {};
+	put(&junk, sizeof(junk));
+	put(&reserved, sizeof(reserved));
+
+	chunk_header fmtHeader;
+	set_id(&fmtHeader, "fmt ");
+	fmtHeader.length = sizeof(wav_fmt);
+	wav_fmt fmt;
+	fmt.format = 1;
+	fmt.channels = (uint16_t)channels;
+	fmt.sampleRate = sampleRate;
+	fmt.byteRate = sampleRate * blockAlign;
+	fmt.blockAlign = (uint16_t)blockAlign;
+	fmt.bitsPerSample = 16;
+	put(&fmtHeader, sizeof(fmtHeader));
+	put(&fmt, sizeof(fmt));
+
+	chunk_header data;
+	set_id(&data, "data");
+	data.length = 0;
+	put(&data, sizeof(data));
+	dataStart = DATA_HEADER_OFFSET + sizeof(chunk_header);
+}
+
+void WavWriter::write(const int16_t* frames, int count) {
+	le_int16_t buffer[4096];
+	size_t remaining = (size_t)count * channels;
+	while (remaining > 0) {
+		size_t n = remaining < 4096 ? remaining : 4096;
+		for (size_t i = 0; i < n; i++)
+			buffer[i] = frames[i];
+		put(buffer, n * sizeof(le_int16_t));
+		frames += n;
+		remaining -= n;
+	}
+	dataSize += (uint64_t)count * blockAlign;
+}
+
+void WavWriter::set_loop(uint32_t start, uint32_t end) {
+	looping = true;
+	loopStart = start;
+	loopEnd = end;
+}
+
+void WavWriter::close() {
+	if (looping) {
+		chunk_header header;
+		set_id(&header, "smpl");
+		header.length = sizeof(wav_smpl);
+		wav_smpl smpl = {};
+		smpl.sampleLoopCount = 1;
+		smpl.start = loopStart;
+		smpl.end = loopEnd;
+		put(&header, sizeof(header));
+		put(&smpl, sizeof(smpl));
+	}
+
+	uint64_t riffSize = dataStart + dataSize - 8 + (looping ? sizeof(chunk_header) + sizeof(wav_smpl) : 0);
+	if (riffSize <= 0xFFFFFFFFu) {
+		le_uint32_t size = (uint32_t)riffSize;
+		patch(RIFF_SIZE_OFFSET, &size, 4);
+		size = (uint32_t)dataSize;
+		patch(DATA_HEADER_OFFSET + 4, &size, 4);
+	} else {
+		// RF64: the 32-bit sizes become 0xFFFFFFFF and the real ones go in ds64
+		patch(0, "RF64", 4);
+		le_uint32_t unknown = 0xFFFFFFFFu;
+		patch(RIFF_SIZE_OFFSET, &unknown, 4);
+		patch(DATA_HEADER_OFFSET + 4, &unknown, 4);
+
+		ds64 sizes;
+		uint64_t samples = frames_written();
+		sizes.riffSizeLow = (uint32_t)riffSize;
+		sizes.riffSizeHigh = (uint32_t)(riffSize >> 32);
+		sizes.dataSizeLow = (uint32_t)dataSize;
+		sizes.dataSizeHigh = (uint32_t)(dataSize >> 32);
+		sizes.sampleCountLow = (uint32_t)samples;
+		sizes.sampleCountHigh = (uint32_t)(samples >> 32);
+		sizes.tableLength = 0;
+		patch(JUNK_OFFSET, "ds64", 4);
+		patch(JUNK_OFFSET + 8, &sizes, sizeof(sizes));
+	}
+
+	if (fflush(file) != 0)
+		throw std::runtime_error("Could not write WAV file");
+	file = NULL;
+}
+
+void WavWriter::put(const void* data, size_t size) {
+	if (fwrite(data, 1, size, file) != size)
+		throw std::runtime_error("Could not write WAV file");
+}
+
+void WavWriter::patch(int64_t position, const void* data, size_t size) {
+	if (seek(file, position) != 0)
+		throw std::runtime_error("Could not seek in WAV file");
+	put(data, size);
+	if (fseek(file, 0, SEEK_END) != 0)
+		throw std::runtime_error("Could not seek in WAV file");
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+
+namespace rstmcpp {
+	namespace pcm16 {
+		// Writes a 16-bit PCM WAV file as samples arrive, so nothing but the current chunk
+		// has to be in memory. The RIFF and data sizes are patched in by close(), which needs
+		// a seekable file. A JUNK chunk reserves room for an RF64 ds64 chunk, so outputs that
+		// grow past 4 GB are turned into RF64 files in place instead of being rewritten.
+		class WavWriter {
+		public:
+			WavWriter();
+
+			// Writes the headers. The file stays owned by the caller.
+			void open(FILE* file, int channels, int sampleRate);
+
+			// Appends count frames of interleaved native-endian samples.
+			void write(const int16_t* frames, int count);
+
+			// Adds a smpl chunk with one forward loop when the file is closed.
+			void set_loop(uint32_t start, uint32_t end);
+
+			// Writes the smpl chunk, if any, and the final sizes. Does not close the file.
+			void close();
+
+			uint64_t frames_written() const { return dataSize / blockAlign; }
+
+		private:
+			void put(const void* data, size_t size);
+			void patch(int64_t position, const void* data, size_t size);
+
+			FILE* file;
+			int channels;
+			int blockAlign;
+			int64_t dataStart; //Offset of the data chunk's first sample
+			uint64_t dataSize;
+
+			bool looping;
+			uint32_t loopStart;
+			uint32_t loopEnd;
+		};
+	}
+}